@@ -0,0 +1,292 @@
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Approximate access frequencies (count-min sketch of 4-bit counters) for TinyLFU admission.
+// Counters are relaxed atomics so that readers holding only a shared lock can record accesses.
+// Every `sample_size` recorded accesses all counters are halved, so old popularity decays.
+
+class FrequencySketch
+{
+public:
+
+    explicit FrequencySketch(std::size_t capacity)
+    : width_{ round_up_to_power_of_two(std::max<std::size_t>(capacity, 16)) }
+    , shift_{ 64 - static_cast<unsigned int>(std::countr_zero(width_)) }
+    , sample_size_{ 10 * width_ }
+    , counters_{ std::make_unique<std::atomic<std::uint8_t>[]>(Rows * width_) }
+    {
+    }
+
+    void increment(std::size_t hash)
+    {
+        for (std::size_t row{ 0 }; row < Rows; row++)
+        {
+            auto& counter = counters_[index_of(hash, row)];
+            if (counter.load(std::memory_order_relaxed) < MaxCount)
+                counter.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        additions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] unsigned int estimate(std::size_t hash) const
+    {
+        unsigned int count{ MaxCount };
+        for (std::size_t row{ 0 }; row < Rows; row++)
+            count = std::min<unsigned int>(count, counters_[index_of(hash, row)].load(std::memory_order_relaxed));
+
+        return count;
+    }
+
+    // Called by writers only; racing increments from readers may be lost, which the sketch tolerates.
+
+    void try_age()
+    {
+        if (additions_.load(std::memory_order_relaxed) < sample_size_)
+            return;
+
+        for (std::size_t i{ 0 }; i < Rows * width_; i++)
+            counters_[i].store(counters_[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+
+        additions_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+
+    static constexpr std::size_t Rows{ 4 };
+    static constexpr std::uint8_t MaxCount{ 15 };
+    static constexpr std::uint64_t Seeds[Rows]{ 0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0xff51afd7ed558ccdull };
+
+    static std::size_t round_up_to_power_of_two(std::size_t value)
+    {
+        std::size_t result{ 1 };
+        while (result < value)
+            result <<= 1;
+
+        return result;
+    }
+
+    // Multiplicative hashing keeps the high bits of the product, which depend on every bit
+    // of `hash`, so identity hashes such as std::hash<int> still spread across the row.
+
+    std::size_t index_of(std::size_t hash, std::size_t row) const
+    {
+        std::uint64_t mixed = (static_cast<std::uint64_t>(hash) + row) * Seeds[row];
+        return row * width_ + static_cast<std::size_t>(mixed >> shift_);
+    }
+
+    std::size_t width_{ };
+    unsigned int shift_{ };
+    std::size_t sample_size_{ };
+    std::unique_ptr<std::atomic<std::uint8_t>[]> counters_{ nullptr };
+    std::atomic<std::size_t> additions_{ 0 };
+};
+
+
+// CLOCK (second-chance) replacement: a hit only sets the entry's reference bit, so `try_get`
+// runs under a shared lock and never mutates the index or the slots. On insertion into a full
+// cache the hand sweeps the slots, clearing reference bits, until it finds an unreferenced
+// victim. With admission enabled, a new key only replaces the victim if the frequency sketch
+// has seen it more often, which keeps one-off scans from flushing the working set.
+
+template <typename Key, typename Value, typename Hasher = std::hash<Key>>
+class ClockCache
+{
+public:
+
+    ClockCache() : ClockCache(1) { }
+    explicit ClockCache(std::size_t capacity, bool use_admission_filter = true)
+    : capacity_{ validated_capacity(capacity) }
+    , use_admission_filter_{ use_admission_filter }
+    , slots_{ std::make_unique<Slot[]>(capacity) }
+    , sketch_{ capacity }
+    {
+        index_.reserve(capacity);
+    }
+
+    ClockCache(const ClockCache&) = delete;
+    ClockCache& operator=(const ClockCache&) = delete;
+
+    bool try_get(const Key& key, Value& value)
+    {
+        auto hash = hasher_(key);
+        if (use_admission_filter_)
+            sketch_.increment(hash);
+
+        std::shared_lock lock{ mutex_ };
+
+        auto item = index_.find(key);
+        if (item == index_.end())
+            return false;
+
+        auto& slot = slots_[item->second];
+        if (!slot.referenced_.load(std::memory_order_relaxed))
+            slot.referenced_.store(true, std::memory_order_relaxed);
+
+        value = slot.value_;
+
+        return true;
+    }
+
+    // Returns false if the admission filter rejected the key.
+
+    bool add(const Key& key, const Value& value)
+    {
+        auto hash = hasher_(key);
+
+        std::unique_lock lock{ mutex_ };
+
+        if (use_admission_filter_)
+        {
+            sketch_.increment(hash);
+            sketch_.try_age();
+        }
+
+        auto item = index_.find(key);
+        if (item != index_.end())
+        {
+            auto& slot = slots_[item->second];
+            slot.value_ = value;
+            slot.referenced_.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        std::size_t position{ };
+        if (index_.size() < capacity_)
+        {
+            position = index_.size();
+        }
+        else
+        {
+            position = find_victim();
+            auto& victim = slots_[position];
+
+            if (use_admission_filter_ && sketch_.estimate(hash) <= sketch_.estimate(hasher_(victim.key_)))
+                return false;
+
+            index_.erase(victim.key_);
+            hand_ = (hand_ + 1) % capacity_;
+        }
+
+        auto& slot = slots_[position];
+        slot.key_ = key;
+        slot.value_ = value;
+        slot.referenced_.store(false, std::memory_order_relaxed);
+        index_.insert({ key, position });
+
+        return true;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        std::shared_lock lock{ mutex_ };
+        return index_.empty();
+    }
+
+    [[nodiscard]] bool full() const
+    {
+        std::shared_lock lock{ mutex_ };
+        return index_.size() == capacity_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        std::shared_lock lock{ mutex_ };
+        return index_.size();
+    }
+
+private:
+
+    struct Slot
+    {
+        Key key_{ };
+        Value value_{ };
+        std::atomic<bool> referenced_{ false };
+    };
+
+    // The hand and the victim slot need at least one slot to point at.
+
+    static std::size_t validated_capacity(std::size_t capacity)
+    {
+        if (capacity == 0)
+            throw std::invalid_argument("ClockCache capacity must be positive");
+
+        return capacity;
+    }
+
+    // Terminates within two sweeps, as the first sweep clears every reference bit.
+
+    std::size_t find_victim()
+    {
+        while (slots_[hand_].referenced_.exchange(false, std::memory_order_relaxed))
+            hand_ = (hand_ + 1) % capacity_;
+
+        return hand_;
+    }
+
+    Hasher hasher_{ };
+    std::size_t capacity_{ };
+    bool use_admission_filter_{ };
+    std::size_t hand_{ 0 };
+    mutable std::shared_mutex mutex_{ };
+    std::unique_ptr<Slot[]> slots_{ nullptr };
+    std::unordered_map<Key, std::size_t, Hasher> index_{ };
+    FrequencySketch sketch_;
+};
+
+TEST_CASE( "Clock cache gives referenced entries a second chance.", "[clock_cache]" )
+{
+    SECTION("Referenced entry survives eviction.")
+    {
+        auto cache = ClockCache<int, int>(2, false);
+        cache.add(1, 10);
+        cache.add(2, 20);
+
+        int value = 0;
+        REQUIRE( cache.try_get(1, value) == true );
+
+        cache.add(3, 30); // Evicts 2, since 1 has its reference bit set.
+
+        REQUIRE( cache.try_get(1, value) == true );
+        REQUIRE( value == 10 );
+        REQUIRE( cache.try_get(2, value) == false );
+        REQUIRE( cache.try_get(3, value) == true );
+        REQUIRE( cache.full() == true );
+    }
+
+    SECTION("Admission filter keeps popular entries during a scan.")
+    {
+        auto cache = ClockCache<int, int>(2);
+        cache.add(1, 10);
+        cache.add(2, 20);
+
+        int value = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            cache.try_get(1, value);
+            cache.try_get(2, value);
+        }
+
+        for (int key = 100; key < 110; key++)
+            REQUIRE( cache.add(key, key) == false );
+
+        REQUIRE( cache.try_get(1, value) == true );
+        REQUIRE( cache.try_get(2, value) == true );
+    }
+
+    SECTION("Zero capacity is rejected.")
+    {
+        REQUIRE_THROWS_AS( (ClockCache<int, int>(0)), std::invalid_argument );
+    }
+}
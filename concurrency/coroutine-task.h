@@ -0,0 +1,786 @@
+#include <coroutine>
+#include <atomic>
+#include <array>
+#include <tuple>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <stdexcept>
+
+#include "thread-pool.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Coroutine frames are recycled through per-thread free lists, one per 64-byte size class,
+// so that starting a Task does not go to the global allocator once a thread's lists are warm.
+// A frame is returned to the list of the thread that destroys it, which is often not the one
+// that created it; each list keeps at most MaxCached frames and frees the rest. Frames larger
+// than the largest class, and frames on a thread whose lists have already been torn down at
+// exit, go to the global allocator directly.
+
+class FrameAllocator
+{
+public:
+
+    static void* allocate(std::size_t size)
+    {
+        auto size_class = ClassOf(size);
+        if (size_class >= ClassCount || destroyed_)
+            return ::operator new(size);
+
+        auto& cache = LocalCache();
+        if (auto* frame = cache.free_[size_class])
+        {
+            cache.free_[size_class] = frame->next_;
+            cache.counts_[size_class]--;
+            return frame;
+        }
+
+        return ::operator new((size_class + 1) * Granularity);
+    }
+
+    static void deallocate(void* pointer, std::size_t size)
+    {
+        auto size_class = ClassOf(size);
+        if (size_class >= ClassCount || destroyed_)
+        {
+            ::operator delete(pointer);
+            return;
+        }
+
+        auto& cache = LocalCache();
+        if (cache.counts_[size_class] == MaxCached)
+        {
+            ::operator delete(pointer);
+            return;
+        }
+
+        cache.free_[size_class] = new (pointer) FreeFrame{ cache.free_[size_class] };
+        cache.counts_[size_class]++;
+    }
+
+private:
+
+    static constexpr std::size_t Granularity{ 64 };
+    static constexpr std::size_t ClassCount{ 16 };
+    static constexpr std::size_t MaxCached{ 64 };
+
+    struct FreeFrame
+    {
+        FreeFrame* next_{ nullptr };
+    };
+
+    struct Cache
+    {
+        ~Cache()
+        {
+            destroyed_ = true;
+            for (auto* frame : free_)
+            {
+                while (frame != nullptr)
+                {
+                    auto* next = frame->next_;
+                    ::operator delete(frame);
+                    frame = next;
+                }
+            }
+        }
+
+        std::array<FreeFrame*, ClassCount> free_{ };
+        std::array<std::size_t, ClassCount> counts_{ };
+    };
+
+    static std::size_t ClassOf(std::size_t size)
+    {
+        return (size - 1) / Granularity;
+    }
+
+    static Cache& LocalCache()
+    {
+        thread_local Cache cache{ };
+        return cache;
+    }
+
+    // Frames destroyed during thread exit, after this thread's cache is gone, bypass it.
+    static inline thread_local bool destroyed_{ false };
+};
+
+
+template <typename T>
+class Task;
+
+class TaskPromiseBase
+{
+public:
+
+    static void* operator new(std::size_t size)
+    {
+        return FrameAllocator::allocate(size);
+    }
+
+    static void operator delete(void* pointer, std::size_t size)
+    {
+        FrameAllocator::deallocate(pointer, size);
+    }
+
+    // Resumes the awaiting coroutine, if any, by symmetric transfer: the current frame is
+    // left before the next one runs, so long chains of awaits do not grow the stack.
+
+    struct FinalAwaiter
+    {
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+        {
+            auto continuation = finished.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept
+    {
+        return { };
+    }
+
+    FinalAwaiter final_suspend() const noexcept
+    {
+        return { };
+    }
+
+    void unhandled_exception()
+    {
+        exception_ = std::current_exception();
+    }
+
+    void set_continuation(std::coroutine_handle<> continuation)
+    {
+        continuation_ = continuation;
+    }
+
+protected:
+
+    std::coroutine_handle<> continuation_{ nullptr };
+    std::exception_ptr exception_{ nullptr };
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        if (exception_)
+            std::rethrow_exception(exception_);
+
+        return std::move(*value_);
+    }
+
+private:
+
+    std::optional<T> value_{ std::nullopt };
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept
+    {
+    }
+
+    void result()
+    {
+        if (exception_)
+            std::rethrow_exception(exception_);
+    }
+};
+
+// Lazily started coroutine returning T. Nothing runs until the task is awaited, at which point
+// the awaiting coroutine is suspended and the task resumed in its place; when the task finishes
+// the awaiting coroutine is resumed on whichever thread finished it. Use `co_await
+// pool.schedule()` inside a task to move it onto a ThreadPool worker, and `spawn` or
+// `sync_wait` to start a task from ordinary code.
+
+template <typename T = void>
+class Task
+{
+public:
+
+    using promise_type = TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(Handle handle) : handle_{ handle } { }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept : handle_{ std::exchange(other.handle_, nullptr) } { }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    [[nodiscard]] bool valid() const
+    {
+        return static_cast<bool>(handle_);
+    }
+
+    [[nodiscard]] bool ready() const
+    {
+        return handle_ && handle_.done();
+    }
+
+    // Awaiting the task yields its result, or rethrows the exception it exited with.
+
+    auto operator co_await() noexcept
+    {
+        struct Awaiter : ReadyAwaiter
+        {
+            T await_resume()
+            {
+                return this->handle_.promise().result();
+            }
+        };
+
+        return Awaiter{ { handle_ } };
+    }
+
+    // Awaiting `when_ready()` only waits for completion and never throws.
+
+    auto when_ready() noexcept
+    {
+        return ReadyAwaiter{ handle_ };
+    }
+
+private:
+
+    struct ReadyAwaiter
+    {
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return handle_.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle_.promise().set_continuation(awaiting);
+            return handle_;
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+        Handle handle_{ nullptr };
+    };
+
+    Handle handle_{ nullptr };
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>{ Task<T>::Handle::from_promise(*this) };
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>{ Task<void>::Handle::from_promise(*this) };
+}
+
+
+// when_all starts one small coroutine per input that awaits it and then arrives at a shared
+// latch. The latch counts the inputs plus the starter, so the awaiting coroutine is resumed
+// exactly once: by the last input to finish, or without suspending at all if every input
+// finished while they were being started.
+
+class WhenAllLatch
+{
+public:
+
+    explicit WhenAllLatch(std::size_t count) : pending_{ count + 1 } { }
+
+    // Returns the coroutine to transfer to: the awaiting one if this was the last arrival.
+
+    std::coroutine_handle<> arrive() noexcept
+    {
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            return continuation_;
+
+        return std::noop_coroutine();
+    }
+
+    template <typename Start>
+    auto wait(Start start) noexcept
+    {
+        struct Awaiter
+        {
+            [[nodiscard]] bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                latch_.continuation_ = awaiting;
+                start_();
+                return latch_.pending_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+
+            WhenAllLatch& latch_;
+            Start start_;
+        };
+
+        return Awaiter{ *this, std::move(start) };
+    }
+
+private:
+
+    std::atomic<std::size_t> pending_{ };
+    std::coroutine_handle<> continuation_{ nullptr };
+};
+
+// Destroys its own frame on completion, then transfers to whatever the latch returns.
+
+class WhenAllMember
+{
+public:
+
+    struct promise_type
+    {
+        static void* operator new(std::size_t size)
+        {
+            return FrameAllocator::allocate(size);
+        }
+
+        static void operator delete(void* pointer, std::size_t size)
+        {
+            FrameAllocator::deallocate(pointer, size);
+        }
+
+        struct FinalAwaiter
+        {
+            [[nodiscard]] bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finished) noexcept
+            {
+                auto& latch = *finished.promise().latch_;
+                finished.destroy();
+                return latch.arrive();
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        WhenAllMember get_return_object() noexcept
+        {
+            return WhenAllMember{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return { };
+        }
+
+        FinalAwaiter final_suspend() const noexcept
+        {
+            return { };
+        }
+
+        void return_void() const noexcept
+        {
+        }
+
+        void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+
+        WhenAllLatch* latch_{ nullptr };
+    };
+
+    template <typename T>
+    static WhenAllMember await(Task<T>& task)
+    {
+        co_await task.when_ready();
+    }
+
+    void start(WhenAllLatch& latch)
+    {
+        handle_.promise().latch_ = &latch;
+        handle_.resume();
+    }
+
+private:
+
+    explicit WhenAllMember(std::coroutine_handle<promise_type> handle) : handle_{ handle } { }
+
+    std::coroutine_handle<promise_type> handle_{ nullptr };
+};
+
+// Runs the tasks concurrently, as far as they schedule themselves onto a pool, and yields
+// their results in order. Every task runs to completion even if one fails; the first failure
+// in argument order is then rethrown. The variadic form takes non-void tasks only.
+
+template <typename... Ts>
+Task<std::tuple<Ts...>> when_all(Task<Ts>... tasks)
+{
+    WhenAllLatch latch{ sizeof...(Ts) };
+    co_await latch.wait([&tasks..., &latch]
+    {
+        (WhenAllMember::await(tasks).start(latch), ...);
+    });
+
+    co_return std::tuple<Ts...>{ co_await tasks... };
+}
+
+template <typename T>
+Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all(std::vector<Task<T>> tasks)
+{
+    WhenAllLatch latch{ tasks.size() };
+    co_await latch.wait([&tasks, &latch]
+    {
+        for (auto& task : tasks)
+            WhenAllMember::await(task).start(latch);
+    });
+
+    if constexpr (std::is_void_v<T>)
+    {
+        for (auto& task : tasks)
+            co_await task;
+    }
+    else
+    {
+        std::vector<T> results{ };
+        results.reserve(tasks.size());
+        for (auto& task : tasks)
+            results.push_back(co_await task);
+
+        co_return results;
+    }
+}
+
+
+// Starts `task` on the calling thread and returns a TaskHandle to its result. The task runs
+// until its first suspension before `spawn` returns. It may finish on any thread, so waiting
+// on the handle blocks even on a pool worker; co_await the task there instead.
+
+template <typename T>
+class SpawnState : public TaskState<T>
+{
+public:
+
+    struct Driver
+    {
+        struct promise_type
+        {
+            static void* operator new(std::size_t size)
+            {
+                return FrameAllocator::allocate(size);
+            }
+
+            static void operator delete(void* pointer, std::size_t size)
+            {
+                FrameAllocator::deallocate(pointer, size);
+            }
+
+            Driver get_return_object() const noexcept
+            {
+                return { };
+            }
+
+            std::suspend_never initial_suspend() const noexcept
+            {
+                return { };
+            }
+
+            std::suspend_never final_suspend() const noexcept
+            {
+                return { };
+            }
+
+            void return_void() const noexcept
+            {
+            }
+
+            void unhandled_exception() const noexcept
+            {
+                std::terminate();
+            }
+        };
+    };
+
+    static Driver drive(Task<T> task, std::shared_ptr<SpawnState> state)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+                co_await task;
+            else
+                state->value_.emplace(co_await task);
+        }
+        catch (...)
+        {
+            state->exception_ = std::current_exception();
+        }
+
+        // Destroy the task's frame before anyone waiting on the handle can observe completion.
+        task = Task<T>{ };
+        state->complete();
+    }
+};
+
+template <typename T>
+TaskHandle<T> spawn(Task<T> task)
+{
+    auto state = std::make_shared<SpawnState<T>>();
+    SpawnState<T>::drive(std::move(task), state);
+    return TaskHandle<T>{ std::move(state) };
+}
+
+template <typename T>
+T sync_wait(Task<T> task)
+{
+    return spawn(std::move(task)).get();
+}
+
+
+TEST_CASE( "Tasks start lazily and resume their awaiter.", "[coroutine_task]" )
+{
+    SECTION( "Nothing runs until the task is awaited." )
+    {
+        bool started = false;
+        auto task = [](bool& started) -> Task<int> { started = true; co_return 1; }(started);
+
+        REQUIRE( started == false );
+        REQUIRE( sync_wait(std::move(task)) == 1 );
+        REQUIRE( started == true );
+    }
+
+    SECTION( "Deep chains of awaits do not grow the stack." )
+    {
+        // AddressSanitizer stops GCC from turning symmetric transfer into a tail call, so each
+        // await nests a frame there; keep the chain short enough for its larger frames.
+#if defined(__SANITIZE_ADDRESS__)
+        constexpr int Depth = 1'000;
+#else
+        constexpr int Depth = 10'000;
+#endif
+
+        auto chain = [](auto chain, int depth) -> Task<int>
+        {
+            if (depth == 0)
+                co_return 0;
+
+            co_return 1 + co_await chain(chain, depth - 1);
+        };
+
+        REQUIRE( sync_wait(chain(chain, Depth)) == Depth );
+    }
+
+    SECTION( "schedule moves the task onto a worker." )
+    {
+        ThreadPool pool{ 2 };
+        auto on_worker = [](ThreadPool& pool) -> Task<bool> { co_await pool.schedule(); co_return pool.worker_index().has_value(); };
+
+        REQUIRE( pool.worker_index().has_value() == false );
+        REQUIRE( sync_wait(on_worker(pool)) == true );
+    }
+}
+
+TEST_CASE( "when_all runs every task and keeps argument order.", "[coroutine_task]" )
+{
+    ThreadPool pool{ 4 };
+    auto twice = [](ThreadPool& pool, int value) -> Task<int> { co_await pool.schedule(); co_return 2 * value; };
+
+    SECTION( "Variadic tasks yield a tuple." )
+    {
+        auto first = twice(pool, 1);
+        auto second = twice(pool, 2);
+        auto [a, b] = sync_wait(when_all(std::move(first), std::move(second)));
+
+        REQUIRE( a == 2 );
+        REQUIRE( b == 4 );
+    }
+
+    SECTION( "A vector of tasks yields a vector." )
+    {
+        std::vector<Task<int>> tasks{ };
+        for (int i = 0; i < 100; i++)
+            tasks.push_back(twice(pool, i));
+
+        auto results = sync_wait(when_all(std::move(tasks)));
+
+        REQUIRE( results.size() == 100 );
+        for (int i = 0; i < 100; i++)
+            REQUIRE( results[i] == 2 * i );
+    }
+
+    SECTION( "A vector of void tasks runs them all." )
+    {
+        std::atomic<int> count{ 0 };
+        std::vector<Task<>> tasks{ };
+        for (int i = 0; i < 50; i++)
+            tasks.push_back([](ThreadPool& pool, std::atomic<int>& count) -> Task<> { co_await pool.schedule(); count++; }(pool, count));
+
+        sync_wait(when_all(std::move(tasks)));
+
+        REQUIRE( count == 50 );
+    }
+
+    SECTION( "An empty vector completes at once." )
+    {
+        REQUIRE( sync_wait(when_all(std::vector<Task<int>>{ })).empty() == true );
+    }
+}
+
+TEST_CASE( "Task exceptions reach whoever awaits the result.", "[coroutine_task]" )
+{
+    ThreadPool pool{ 2 };
+    auto fails = [](ThreadPool& pool) -> Task<int> { co_await pool.schedule(); throw std::runtime_error("failed"); };
+
+    SECTION( "Awaiting rethrows." )
+    {
+        auto caught = [](ThreadPool& pool, auto fails) -> Task<bool>
+        {
+            try
+            {
+                co_await fails(pool);
+            }
+            catch (const std::runtime_error&)
+            {
+                co_return true;
+            }
+
+            co_return false;
+        };
+
+        REQUIRE( sync_wait(caught(pool, fails)) == true );
+    }
+
+    SECTION( "when_all finishes the other tasks before rethrowing." )
+    {
+        std::atomic<bool> finished{ false };
+        auto slow = [](ThreadPool& pool, std::atomic<bool>& finished) -> Task<int>
+        {
+            co_await pool.schedule();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            finished = true;
+            co_return 1;
+        };
+
+        REQUIRE_THROWS_AS( sync_wait(when_all(fails(pool), slow(pool, finished))), std::runtime_error );
+        REQUIRE( finished == true );
+    }
+
+    SECTION( "A spawned task's handle rethrows." )
+    {
+        auto handle = spawn(fails(pool));
+
+        REQUIRE_THROWS_AS( handle.get(), std::runtime_error );
+    }
+}
+
+TEST_CASE( "spawn runs the task until its first suspension.", "[coroutine_task]" )
+{
+    SECTION( "A task that never suspends is ready on return." )
+    {
+        auto handle = spawn([]() -> Task<int> { co_return 7; }());
+
+        REQUIRE( handle.ready() == true );
+        REQUIRE( handle.get() == 7 );
+    }
+
+    SECTION( "A task that moves to a pool finishes there." )
+    {
+        ThreadPool pool{ 1 };
+        std::atomic<bool> release{ false };
+        auto handle = spawn([](ThreadPool& pool, std::atomic<bool>& release) -> Task<int>
+        {
+            co_await pool.schedule();
+            while (!release.load())
+                std::this_thread::yield();
+
+            co_return 9;
+        }(pool, release));
+
+        REQUIRE( handle.ready() == false );
+        release = true;
+        REQUIRE( handle.get() == 9 );
+    }
+}
+
+TEST_CASE( "FrameAllocator recycles frames by size class.", "[coroutine_task]" )
+{
+    SECTION( "A freed frame is reused for any size in its class." )
+    {
+        auto* frame = FrameAllocator::allocate(100);
+        FrameAllocator::deallocate(frame, 100);
+
+        auto* reused = FrameAllocator::allocate(120);
+        REQUIRE( reused == frame );
+        FrameAllocator::deallocate(reused, 120);
+    }
+
+    SECTION( "Frames beyond the largest class go to the global allocator." )
+    {
+        auto* large = FrameAllocator::allocate(64 * 1024);
+        FrameAllocator::deallocate(large, 64 * 1024);
+
+        auto* frame = FrameAllocator::allocate(64);
+        FrameAllocator::deallocate(frame, 64);
+        REQUIRE( FrameAllocator::allocate(64) == frame );
+        FrameAllocator::deallocate(frame, 64);
+    }
+}
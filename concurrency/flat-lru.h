@@ -0,0 +1,416 @@
+#include <memory>
+#include <chrono>
+#include <limits>
+#include <utility>
+#include <cstdint>
+#include <functional>
+#include <bit>
+#include <thread>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <list>
+#include <unordered_map>
+#include <fstream>
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+struct CacheStatistics
+{
+    std::size_t hits_{ };
+    std::size_t misses_{ };
+    std::size_t evictions_{ };
+    std::size_t expirations_{ };
+};
+
+// A LeastRecentlyUsedCache that never allocates after construction. Entries live in one
+// preallocated array and the recency list is a doubly linked list of 32-bit indices threaded
+// through those entries. The index is an open-addressing table of entry indices with linear
+// probing, so each key is stored exactly once.
+
+// Compared with std::list + std::unordered_map this drops two heap nodes, three pointers and a
+// bucket pointer per entry: an entry costs sizeof(Key) + sizeof(Value) + 16 bytes, plus 8 to 16
+// bytes of table, as the table is kept at most half full.
+
+// Entries may carry a time-to-live. Expiry is lazy: an expired entry is only removed when it is
+// looked up, or when it reaches the tail of the recency list and is evicted like any other.
+
+template <typename Key, typename Value, typename Hasher = std::hash<Key>>
+class FlatLeastRecentlyUsedCache
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    FlatLeastRecentlyUsedCache() : FlatLeastRecentlyUsedCache(1) { }
+    explicit FlatLeastRecentlyUsedCache(std::size_t capacity, Clock::duration ttl = Clock::duration::zero())
+    : capacity_{ validated_capacity(capacity) }
+    , ttl_{ ttl }
+    , table_size_{ std::bit_ceil(std::max<std::size_t>(2 * capacity, 2)) }
+    , shift_{ 64 - static_cast<unsigned int>(std::countr_zero(table_size_)) }
+    , entries_{ std::make_unique<Entry[]>(capacity) }
+    , table_{ std::make_unique<std::uint32_t[]>(table_size_) }
+    {
+        for (std::size_t i{ 0 }; i < table_size_; i++)
+            table_[i] = Empty;
+    }
+
+    FlatLeastRecentlyUsedCache(const FlatLeastRecentlyUsedCache&) = delete;
+    FlatLeastRecentlyUsedCache& operator=(const FlatLeastRecentlyUsedCache&) = delete;
+
+    bool try_get(const Key& key, Value& value)
+    {
+        auto slot = find_slot(key);
+        if (table_[slot] == Empty)
+        {
+            statistics_.misses_++;
+            return false;
+        }
+
+        auto index = table_[slot];
+        // Entries without a TTL never expire, so only read the clock for those that have one.
+        auto& entry = entries_[index];
+        if (entry.expires_at_ != Clock::time_point::max() && entry.expires_at_ <= Clock::now())
+        {
+            remove(slot, index);
+            statistics_.expirations_++;
+            statistics_.misses_++;
+            return false;
+        }
+
+        move_to_front(index);
+        statistics_.hits_++;
+
+        value = entry.value_;
+
+        return true;
+    }
+
+    void add(const Key& key, const Value& value)
+    {
+        emplace(key, value, ttl_);
+    }
+
+    void add(const Key& key, Value&& value)
+    {
+        emplace(key, std::move(value), ttl_);
+    }
+
+    void add(const Key& key, const Value& value, Clock::duration ttl)
+    {
+        emplace(key, value, ttl);
+    }
+
+    void add(const Key& key, Value&& value, Clock::duration ttl)
+    {
+        emplace(key, std::move(value), ttl);
+    }
+
+    bool erase(const Key& key)
+    {
+        auto slot = find_slot(key);
+        if (table_[slot] == Empty)
+            return false;
+
+        remove(slot, table_[slot]);
+
+        return true;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] bool full() const
+    {
+        return size_ == capacity_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] const CacheStatistics& statistics() const
+    {
+        return statistics_;
+    }
+
+    void reset_statistics()
+    {
+        statistics_ = { };
+    }
+
+private:
+
+    static constexpr std::uint32_t Empty{ std::numeric_limits<std::uint32_t>::max() };
+
+    // Eviction needs a tail entry, and every entry index must fit a 32-bit link below Empty.
+
+    static std::size_t validated_capacity(std::size_t capacity)
+    {
+        if (capacity == 0 || capacity >= Empty)
+            throw std::invalid_argument("FlatLeastRecentlyUsedCache capacity must be in [1, 2^32 - 1)");
+
+        return capacity;
+    }
+
+    struct Entry
+    {
+        Key key_{ };
+        Value value_{ };
+        Clock::time_point expires_at_{ Clock::time_point::max() };
+        std::uint32_t previous_{ Empty };
+        std::uint32_t next_{ Empty };
+    };
+
+    template <typename V>
+    void emplace(const Key& key, V&& value, Clock::duration ttl)
+    {
+        auto expires_at = ttl == Clock::duration::zero() ? Clock::time_point::max() : Clock::now() + ttl;
+
+        auto slot = find_slot(key);
+        if (table_[slot] != Empty)
+        {
+            auto index = table_[slot];
+            entries_[index].value_ = std::forward<V>(value);
+            entries_[index].expires_at_ = expires_at;
+            move_to_front(index);
+            return;
+        }
+
+        std::uint32_t index{ };
+        if (free_ != Empty)
+        {
+            index = free_;
+            free_ = entries_[index].next_;
+        }
+        else if (used_ < capacity_)
+        {
+            index = static_cast<std::uint32_t>(used_++);
+        }
+        else
+        {
+            index = tail_;
+            unlink(index);
+            erase_slot(find_slot(entries_[index].key_));
+            size_--;
+            statistics_.evictions_++;
+
+            // The victim's slot may have been back-filled, so probe again for the new key.
+            slot = find_slot(key);
+        }
+
+        auto& entry = entries_[index];
+        entry.key_ = key;
+        entry.value_ = std::forward<V>(value);
+        entry.expires_at_ = expires_at;
+        push_front(index);
+        table_[slot] = index;
+        size_++;
+    }
+
+    // Returns the slot holding `key`, or the empty slot where it would be inserted.
+
+    std::size_t find_slot(const Key& key) const
+    {
+        auto slot = home_slot(key);
+        while (table_[slot] != Empty && !(entries_[table_[slot]].key_ == key))
+            slot = (slot + 1) & (table_size_ - 1);
+
+        return slot;
+    }
+
+    std::size_t home_slot(const Key& key) const
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(hasher_(key)) * 0x9e3779b97f4a7c15ull) >> shift_);
+    }
+
+    // Backward-shift deletion: pull later members of the probe run into the hole so that
+    // lookups never need tombstones.
+
+    void erase_slot(std::size_t slot)
+    {
+        auto mask = table_size_ - 1;
+        auto next = (slot + 1) & mask;
+        while (table_[next] != Empty)
+        {
+            auto home = home_slot(entries_[table_[next]].key_);
+            if (((next - home) & mask) >= ((next - slot) & mask))
+            {
+                table_[slot] = table_[next];
+                slot = next;
+            }
+
+            next = (next + 1) & mask;
+        }
+
+        table_[slot] = Empty;
+    }
+
+    void remove(std::size_t slot, std::uint32_t index)
+    {
+        unlink(index);
+        erase_slot(slot);
+        size_--;
+
+        auto& entry = entries_[index];
+        entry.value_ = Value{ };
+        entry.next_ = free_;
+        free_ = index;
+    }
+
+    void move_to_front(std::uint32_t index)
+    {
+        if (head_ == index)
+            return;
+
+        unlink(index);
+        push_front(index);
+    }
+
+    void push_front(std::uint32_t index)
+    {
+        auto& entry = entries_[index];
+        entry.previous_ = Empty;
+        entry.next_ = head_;
+
+        if (head_ != Empty)
+            entries_[head_].previous_ = index;
+        else
+            tail_ = index;
+
+        head_ = index;
+    }
+
+    void unlink(std::uint32_t index)
+    {
+        auto& entry = entries_[index];
+
+        if (entry.previous_ != Empty)
+            entries_[entry.previous_].next_ = entry.next_;
+        else
+            head_ = entry.next_;
+
+        if (entry.next_ != Empty)
+            entries_[entry.next_].previous_ = entry.previous_;
+        else
+            tail_ = entry.previous_;
+    }
+
+    Hasher hasher_{ };
+    std::size_t capacity_{ };
+    Clock::duration ttl_{ };
+    std::size_t table_size_{ };
+    unsigned int shift_{ };
+    std::size_t size_{ 0 };
+    std::size_t used_{ 0 };
+    std::uint32_t head_{ Empty };
+    std::uint32_t tail_{ Empty };
+    std::uint32_t free_{ Empty };
+    std::unique_ptr<Entry[]> entries_{ nullptr };
+    std::unique_ptr<std::uint32_t[]> table_{ nullptr };
+    CacheStatistics statistics_{ };
+};
+
+TEST_CASE( "Flat cache evicts least recently used and expires entries.", "[flat_lru]" )
+{
+    auto cache = FlatLeastRecentlyUsedCache<int, std::string>(2);
+
+    SECTION("Evict least recently used.")
+    {
+        cache.add(1, "one");
+        cache.add(2, "two");
+
+        std::string value;
+        REQUIRE( cache.try_get(1, value) == true );
+
+        cache.add(3, "three");
+
+        REQUIRE( cache.try_get(2, value) == false );
+        REQUIRE( cache.try_get(1, value) == true );
+        REQUIRE( value == "one" );
+        REQUIRE( cache.full() == true );
+        REQUIRE( cache.statistics().hits_ == 2 );
+        REQUIRE( cache.statistics().misses_ == 1 );
+        REQUIRE( cache.statistics().evictions_ == 1 );
+    }
+
+    SECTION("Expired entry is removed on lookup.")
+    {
+        cache.add(1, "one", std::chrono::milliseconds{ 1 });
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 5 });
+
+        std::string value;
+        REQUIRE( cache.try_get(1, value) == false );
+        REQUIRE( cache.empty() == true );
+        REQUIRE( cache.statistics().expirations_ == 1 );
+    }
+
+    SECTION("Capacities outside the 32-bit index range are rejected.")
+    {
+        REQUIRE_THROWS_AS( (FlatLeastRecentlyUsedCache<int, std::string>(0)), std::invalid_argument );
+        REQUIRE_THROWS_AS( (FlatLeastRecentlyUsedCache<int, std::string>(std::numeric_limits<std::uint32_t>::max())), std::invalid_argument );
+    }
+}
+
+#ifdef __linux__
+
+// Resident set size rather than sizeof, so the figure includes allocator overhead and the
+// table slots the flat cache keeps empty.
+
+inline std::size_t ResidentBytes()
+{
+    std::ifstream status{ "/proc/self/status" };
+    std::string field{ };
+    std::size_t kilobytes{ 0 };
+    while (status >> field)
+    {
+        if (field == "VmRSS:")
+        {
+            status >> kilobytes;
+            break;
+        }
+    }
+
+    return kilobytes * 1024;
+}
+
+TEST_CASE( "Flat cache memory per entry at 10M entries.", "[flat_lru][!benchmark]" )
+{
+    constexpr std::size_t Entries = 10'000'000;
+
+    std::size_t flat_bytes{ };
+    {
+        auto before = ResidentBytes();
+        auto cache = FlatLeastRecentlyUsedCache<int, int>(Entries);
+        for (int key = 0; key < static_cast<int>(Entries); key++)
+            cache.add(key, key);
+
+        flat_bytes = ResidentBytes() - before;
+    }
+
+    // The layout LeastRecentlyUsedCache uses: a list node holding the key and a hash node
+    // holding the key again, the value and the list iterator.
+
+    std::size_t node_bytes{ };
+    {
+        auto before = ResidentBytes();
+        std::list<int> keys{ };
+        std::unordered_map<int, std::pair<int, std::list<int>::iterator>> items{ };
+        for (int key = 0; key < static_cast<int>(Entries); key++)
+        {
+            keys.push_back(key);
+            items.insert({ key, { key, std::prev(keys.end()) } });
+        }
+
+        node_bytes = ResidentBytes() - before;
+    }
+
+    WARN( "Bytes per entry: flat " << flat_bytes / Entries << ", list and map " << node_bytes / Entries );
+    REQUIRE( flat_bytes * 3 < node_bytes * 2 );
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#endif
+
+
+// Minimal futex wrappers for 32-bit atomics: process-private waits on Linux, C++20 atomic
+// wait/notify elsewhere. Waits return immediately if the word no longer holds `expected`, so a
+// wake-up between the caller's last check and the wait is never lost. Callers re-check their
+// condition after every return, as waits may also end spuriously.
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) && std::atomic<std::uint32_t>::is_always_lock_free);
+
+#ifdef __linux__
+
+inline long Futex(std::atomic<std::uint32_t>& word, int operation, std::uint32_t value, const timespec* timeout = nullptr)
+{
+    return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), operation, value, timeout, nullptr, 0);
+}
+
+inline void FutexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected)
+{
+    Futex(word, FUTEX_WAIT_PRIVATE, expected);
+}
+
+// Returns false if `timeout` elapsed.
+
+inline bool FutexWaitFor(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout)
+{
+    if (timeout <= std::chrono::nanoseconds::zero())
+        return false;
+
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    timespec relative{ static_cast<time_t>(seconds.count()), static_cast<long>((timeout - seconds).count()) };
+
+    return !(Futex(word, FUTEX_WAIT_PRIVATE, expected, &relative) == -1 && errno == ETIMEDOUT);
+}
+
+inline void FutexWake(std::atomic<std::uint32_t>& word, int count)
+{
+    Futex(word, FUTEX_WAKE_PRIVATE, static_cast<std::uint32_t>(count));
+}
+
+#else
+
+inline void FutexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected)
+{
+    word.wait(expected, std::memory_order_relaxed);
+}
+
+inline bool FutexWaitFor(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (word.load(std::memory_order_relaxed) == expected)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+
+        std::this_thread::yield();
+    }
+
+    return true;
+}
+
+inline void FutexWake(std::atomic<std::uint32_t>& word, int count)
+{
+    if (count == 1)
+        word.notify_one();
+    else
+        word.notify_all();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+// Log2-bucketed histogram of durations: bucket b counts durations of [2^(b-1), 2^b) nanoseconds.
+// Coarse, but recording is a bit scan and an increment, and histograms merge by addition.
+
+struct LatencyHistogram
+{
+    static constexpr std::size_t Buckets{ 64 };
+
+    static std::size_t BucketOf(std::uint64_t nanoseconds)
+    {
+        return std::min<std::size_t>(static_cast<std::size_t>(std::bit_width(nanoseconds)), Buckets - 1);
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for (std::size_t i{ 0 }; i < Buckets; i++)
+            counts_[i] += other.counts_[i];
+    }
+
+    [[nodiscard]] std::uint64_t count() const
+    {
+        std::uint64_t count{ 0 };
+        for (auto bucket : counts_)
+            count += bucket;
+
+        return count;
+    }
+
+    // Upper bound of the bucket holding the given quantile, e.g. percentile(0.99).
+
+    [[nodiscard]] std::chrono::nanoseconds percentile(double quantile) const
+    {
+        auto rank = static_cast<std::uint64_t>(quantile * static_cast<double>(count()));
+        std::uint64_t seen{ 0 };
+        for (std::size_t i{ 0 }; i < Buckets; i++)
+        {
+            seen += counts_[i];
+            if (seen > rank)
+                return std::chrono::nanoseconds{ i == 0 ? 0 : (std::int64_t{ 1 } << std::min<std::size_t>(i, 62)) };
+        }
+
+        return std::chrono::nanoseconds{ 0 };
+    }
+
+    std::array<std::uint64_t, Buckets> counts_{ };
+};
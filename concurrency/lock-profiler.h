@@ -0,0 +1,457 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <ostream>
+#include <utility>
+#include <optional>
+#include <cstdint>
+#include <thread>
+#include <limits>
+#include <sstream>
+
+#include "latency-histogram.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Contention profiling for any of our locks (Mutex, ReaderWriterLock, Semaphore and the like):
+// declare the lock as ProfiledLock<Mutex> lock_{ "order_book" } and every acquisition is
+// recorded against the site named "order_book" in the LockRegistry. Instances sharing a name
+// share a site, so a lock per shard or per object still shows up as one line.
+
+// Profiling is compiled in with -DLOCK_PROFILING. Without it ProfiledLock<Lock> is just a Lock
+// that accepts and ignores the name, so the wrapper can stay in the code permanently.
+
+struct LockSiteReport
+{
+    std::string name_{ };
+    std::uint64_t acquisitions_{ };
+    std::uint64_t contended_{ };
+    std::chrono::nanoseconds total_wait_{ };
+    std::chrono::nanoseconds max_wait_{ };
+    LatencyHistogram hold_time_{ };
+};
+
+class LockSiteStatistics
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit LockSiteStatistics(std::string name) : name_{ std::move(name) } { }
+
+    void record_acquisition(Clock::duration waited, bool contended)
+    {
+        auto nanoseconds = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        if (!contended)
+            return;
+
+        contended_.fetch_add(1, std::memory_order_relaxed);
+        total_wait_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        auto max_wait = max_wait_.load(std::memory_order_relaxed);
+        while (nanoseconds > max_wait && !max_wait_.compare_exchange_weak(max_wait, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void record_hold(Clock::duration held)
+    {
+        auto nanoseconds = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(held).count());
+        hold_time_[LatencyHistogram::BucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] const std::string& name() const
+    {
+        return name_;
+    }
+
+    [[nodiscard]] LockSiteReport report() const
+    {
+        LockSiteReport report{ };
+        report.name_ = name_;
+        report.acquisitions_ = acquisitions_.load(std::memory_order_relaxed);
+        report.contended_ = contended_.load(std::memory_order_relaxed);
+        report.total_wait_ = std::chrono::nanoseconds{ total_wait_.load(std::memory_order_relaxed) };
+        report.max_wait_ = std::chrono::nanoseconds{ max_wait_.load(std::memory_order_relaxed) };
+        for (std::size_t i{ 0 }; i < LatencyHistogram::Buckets; i++)
+            report.hold_time_.counts_[i] = hold_time_[i].load(std::memory_order_relaxed);
+
+        return report;
+    }
+
+private:
+
+    std::string name_{ };
+
+    // Updated by every thread using the site, so kept off the line holding the name.
+    alignas(64) std::atomic<std::uint64_t> acquisitions_{ 0 };
+    std::atomic<std::uint64_t> contended_{ 0 };
+    std::atomic<std::uint64_t> total_wait_{ 0 };
+    std::atomic<std::uint64_t> max_wait_{ 0 };
+    std::array<std::atomic<std::uint64_t>, LatencyHistogram::Buckets> hold_time_{ };
+};
+
+// Process-wide list of lock sites. Sites are never removed, so a lock can keep a plain
+// reference to its statistics; looking a site up takes the registry's lock and is done once,
+// when the lock is constructed.
+
+class LockRegistry
+{
+public:
+
+    static LockRegistry& instance()
+    {
+        static LockRegistry registry{ };
+        return registry;
+    }
+
+    LockSiteStatistics& site(std::string_view name)
+    {
+        std::scoped_lock lock{ mutex_ };
+
+        for (auto& site : sites_)
+        {
+            if (site.name() == name)
+                return site;
+        }
+
+        return sites_.emplace_back(std::string{ name });
+    }
+
+    // Sites ordered by total time spent waiting, worst first.
+
+    [[nodiscard]] std::vector<LockSiteReport> hottest(std::size_t count = 10) const
+    {
+        std::vector<LockSiteReport> reports{ };
+        {
+            std::scoped_lock lock{ mutex_ };
+            for (const auto& site : sites_)
+                reports.push_back(site.report());
+        }
+
+        std::sort(reports.begin(), reports.end(), [](const auto& left, const auto& right) { return left.total_wait_ > right.total_wait_; });
+        if (reports.size() > count)
+            reports.resize(count);
+
+        return reports;
+    }
+
+    void dump(std::ostream& output, std::size_t count = 10) const
+    {
+        output << "lock site, acquisitions, contended, total wait us, max wait us, p50 hold ns, p99 hold ns\n";
+        for (const auto& report : hottest(count))
+        {
+            output << report.name_ << ", " << report.acquisitions_ << ", " << report.contended_
+                   << ", " << std::chrono::duration_cast<std::chrono::microseconds>(report.total_wait_).count()
+                   << ", " << std::chrono::duration_cast<std::chrono::microseconds>(report.max_wait_).count()
+                   << ", " << report.hold_time_.percentile(0.5).count()
+                   << ", " << report.hold_time_.percentile(0.99).count() << "\n";
+        }
+    }
+
+private:
+
+    LockRegistry() = default;
+
+    mutable std::mutex mutex_{ };
+    std::deque<LockSiteStatistics> sites_{ };
+};
+
+
+#ifdef LOCK_PROFILING
+
+// An acquisition is contended if the lock's try variant (try_lock, TryReaderLock,
+// try_acquire, ...) fails first. For a lock without one it is contended if it took longer
+// than ContendedThreshold. Hold times are recorded for exclusive acquisitions only, as shared
+// holders and semaphore permits have no single owner to time. Every operation of the wrapped
+// lock is forwarded, so profiling a lock does not narrow its interface.
+
+template <typename Lock>
+class ProfiledLock
+{
+public:
+
+    using Clock = LockSiteStatistics::Clock;
+
+    static constexpr Clock::duration ContendedThreshold{ std::chrono::microseconds{ 1 } };
+
+    template <typename... Args>
+    explicit ProfiledLock(std::string_view name, Args&&... args)
+    : lock_(std::forward<Args>(args)...)
+    , statistics_{ LockRegistry::instance().site(name) }
+    {
+    }
+
+    ProfiledLock(const ProfiledLock&) = delete;
+    ProfiledLock& operator=(const ProfiledLock&) = delete;
+
+    void lock() requires requires (Lock lock) { lock.lock(); }
+    {
+        Acquire([this] { return TryLock(lock_); }, [this] { lock_.lock(); });
+        acquired_at_ = Clock::now();
+    }
+
+    bool try_lock() requires requires (Lock lock) { lock.try_lock(); }
+    {
+        if (!lock_.try_lock())
+            return false;
+
+        statistics_.record_acquisition(Clock::duration::zero(), false);
+        acquired_at_ = Clock::now();
+
+        return true;
+    }
+
+    void unlock() requires requires (Lock lock) { lock.unlock(); }
+    {
+        statistics_.record_hold(Clock::now() - acquired_at_);
+        lock_.unlock();
+    }
+
+    void lock_shared() requires requires (Lock lock) { lock.lock_shared(); }
+    {
+        Acquire([this] { return TryLockShared(lock_); }, [this] { lock_.lock_shared(); });
+    }
+
+    bool try_lock_shared() requires requires (Lock lock) { lock.try_lock_shared(); }
+    {
+        if (!lock_.try_lock_shared())
+            return false;
+
+        statistics_.record_acquisition(Clock::duration::zero(), false);
+        return true;
+    }
+
+    void unlock_shared() requires requires (Lock lock) { lock.unlock_shared(); }
+    {
+        lock_.unlock_shared();
+    }
+
+    void ReaderLock() requires requires (Lock lock) { lock.ReaderLock(); }
+    {
+        Acquire([this] { return TryReader(lock_); }, [this] { lock_.ReaderLock(); });
+    }
+
+    bool TryReaderLock() requires requires (Lock lock) { lock.TryReaderLock(); }
+    {
+        if (!lock_.TryReaderLock())
+            return false;
+
+        statistics_.record_acquisition(Clock::duration::zero(), false);
+        return true;
+    }
+
+    void ReaderUnlock() requires requires (Lock lock) { lock.ReaderUnlock(); }
+    {
+        lock_.ReaderUnlock();
+    }
+
+    void WriterLock() requires requires (Lock lock) { lock.WriterLock(); }
+    {
+        Acquire([this] { return TryWriter(lock_); }, [this] { lock_.WriterLock(); });
+        acquired_at_ = Clock::now();
+    }
+
+    bool TryWriterLock() requires requires (Lock lock) { lock.TryWriterLock(); }
+    {
+        if (!lock_.TryWriterLock())
+            return false;
+
+        statistics_.record_acquisition(Clock::duration::zero(), false);
+        acquired_at_ = Clock::now();
+
+        return true;
+    }
+
+    void WriterUnlock() requires requires (Lock lock) { lock.WriterUnlock(); }
+    {
+        statistics_.record_hold(Clock::now() - acquired_at_);
+        lock_.WriterUnlock();
+    }
+
+    // Semaphore operations take an optional permit count, forwarded as given.
+
+    template <typename... Args>
+    void acquire(Args... args) requires requires (Lock lock) { lock.acquire(args...); }
+    {
+        Acquire([this, args...] { return TryAcquire(lock_, args...); }, [this, args...] { lock_.acquire(args...); });
+    }
+
+    template <typename... Args>
+    bool try_acquire(Args... args) requires requires (Lock lock) { lock.try_acquire(args...); }
+    {
+        if (!lock_.try_acquire(args...))
+            return false;
+
+        statistics_.record_acquisition(Clock::duration::zero(), false);
+        return true;
+    }
+
+    template <typename Duration, typename... Args>
+    bool try_acquire_for(Duration timeout, Args... args) requires requires (Lock lock) { lock.try_acquire_for(timeout, args...); }
+    {
+        if (lock_.try_acquire(args...))
+        {
+            statistics_.record_acquisition(Clock::duration::zero(), false);
+            return true;
+        }
+
+        auto started = Clock::now();
+        if (!lock_.try_acquire_for(timeout, args...))
+            return false;
+
+        statistics_.record_acquisition(Clock::now() - started, true);
+        return true;
+    }
+
+    template <typename... Args>
+    void release(Args... args) requires requires (Lock lock) { lock.release(args...); }
+    {
+        lock_.release(args...);
+    }
+
+private:
+
+    // Each returns an empty optional if the lock has no such try variant.
+
+    template <typename L>
+    static std::optional<bool> TryLock(L& lock)
+    {
+        if constexpr (requires { lock.try_lock(); })
+            return lock.try_lock();
+        else
+            return std::nullopt;
+    }
+
+    template <typename L>
+    static std::optional<bool> TryLockShared(L& lock)
+    {
+        if constexpr (requires { lock.try_lock_shared(); })
+            return lock.try_lock_shared();
+        else
+            return std::nullopt;
+    }
+
+    template <typename L>
+    static std::optional<bool> TryReader(L& lock)
+    {
+        if constexpr (requires { lock.TryReaderLock(); })
+            return lock.TryReaderLock();
+        else
+            return std::nullopt;
+    }
+
+    template <typename L>
+    static std::optional<bool> TryWriter(L& lock)
+    {
+        if constexpr (requires { lock.TryWriterLock(); })
+            return lock.TryWriterLock();
+        else
+            return std::nullopt;
+    }
+
+    template <typename L, typename... Args>
+    static std::optional<bool> TryAcquire(L& lock, Args... args)
+    {
+        if constexpr (requires { lock.try_acquire(args...); })
+            return lock.try_acquire(args...);
+        else
+            return std::nullopt;
+    }
+
+    template <typename Try, typename Block>
+    void Acquire(Try&& try_acquire, Block&& block)
+    {
+        auto started = Clock::now();
+
+        auto acquired = try_acquire();
+        if (acquired.value_or(false))
+        {
+            statistics_.record_acquisition(Clock::duration::zero(), false);
+            return;
+        }
+
+        block();
+
+        auto waited = Clock::now() - started;
+        statistics_.record_acquisition(waited, acquired.has_value() || waited > ContendedThreshold);
+    }
+
+    Lock lock_;
+    LockSiteStatistics& statistics_;
+
+    // Written by the exclusive holder only.
+    Clock::time_point acquired_at_{ };
+};
+
+#else
+
+template <typename Lock>
+class ProfiledLock : public Lock
+{
+public:
+
+    template <typename... Args>
+    explicit ProfiledLock(std::string_view, Args&&... args)
+    : Lock(std::forward<Args>(args)...)
+    {
+    }
+};
+
+#endif
+
+
+#ifdef LOCK_PROFILING
+
+// Smoke test for profiling builds: one blocked acquisition shows up as contention.
+
+TEST_CASE( "ProfiledLock records contention.", "[lock_profiler]" )
+{
+    ProfiledLock<std::mutex> lock{ "lock_profiler_smoke" };
+
+    lock.lock();
+    std::jthread waiter{ [&lock] { std::scoped_lock guard{ lock }; } };
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    lock.unlock();
+    waiter.join();
+
+    auto reports = LockRegistry::instance().hottest(std::numeric_limits<std::size_t>::max());
+    auto site = std::find_if(reports.begin(), reports.end(), [](const auto& report) { return report.name_ == "lock_profiler_smoke"; });
+
+    REQUIRE( site != reports.end() );
+    REQUIRE( site->acquisitions_ == 2 );
+    REQUIRE( site->contended_ == 1 );
+    REQUIRE( site->max_wait_ >= std::chrono::milliseconds(1) );
+    REQUIRE( site->total_wait_ >= site->max_wait_ );
+    REQUIRE( site->hold_time_.count() == 2 );
+
+    std::ostringstream dump{ };
+    LockRegistry::instance().dump(dump, std::numeric_limits<std::size_t>::max());
+    REQUIRE( dump.str().find("lock_profiler_smoke, 2, 1, ") != std::string::npos );
+}
+
+#else
+
+TEST_CASE( "ProfiledLock is the plain lock without LOCK_PROFILING.", "[lock_profiler]" )
+{
+    static_assert(sizeof(ProfiledLock<std::mutex>) == sizeof(std::mutex));
+
+    ProfiledLock<std::mutex> lock{ "lock_profiler_smoke" };
+    std::scoped_lock guard{ lock };
+
+    REQUIRE( LockRegistry::instance().hottest().empty() == true );
+}
+
+#endif
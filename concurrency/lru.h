@@ -1,8 +1,23 @@
 #include <unordered_map>
 #include <list>
 #include <iterator>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <string>
 
 #include <catch2/catch_test_macros.hpp> // For testing.
+#include <catch2/benchmark/catch_benchmark.hpp> // For benchmarking.
 
 
 template <typename Key, typename Value>
@@ -16,44 +31,46 @@ public:
 
     LeastRecentlyUsedCache() : LeastRecentlyUsedCache(1) { }
     explicit LeastRecentlyUsedCache(std::size_t capacity)
-    : capacity_{ capacity } 
-    { 
+    : capacity_{ capacity }
+    {
     }
 
     // Can also use std::optional.
 
     bool try_get(const Key& key, Value& value)
     {
-        if (!items_.count(key))
+        auto item = items_.find(key);
+        if (item == items_.end())
             return false;
 
-        on_item_accessed(key);
+        on_item_accessed(item->second.second);
 
-        value = items_.at(key).first;
+        value = item->second.first;
 
         return true;
     }
 
-    void add(const Key& key, Value& value)
+    // Does not need a default-constructible Value.
+
+    std::optional<Value> try_get(const Key& key)
     {
-        if (items_.size() == capacity_)
-        {
-            auto least_recently_used = keys_.front();
-            keys_.pop_front();
-            items_.erase(least_recently_used);
-        }
+        auto item = items_.find(key);
+        if (item == items_.end())
+            return std::nullopt;
 
-        if (items_.count(key))
-        {
-            const auto& [value, iterator] = items_.at(key);
-            keys_.erase(iterator);
-            items_.erase(key);
-        }
+        on_item_accessed(item->second.second);
 
-        keys_.push_back(key);
-        auto end_iterator = keys_.end();
-        std::advance(end_iterator, -1);
-        items_.insert({key, {value, end_iterator}});
+        return item->second.first;
+    }
+
+    void add(const Key& key, const Value& value)
+    {
+        emplace(key, value);
+    }
+
+    void add(const Key& key, Value&& value)
+    {
+        emplace(key, std::move(value));
     }
 
     [[nodiscard]] bool empty() const
@@ -66,20 +83,325 @@ public:
         return items_.size() == capacity_;
     }
 
+    [[nodiscard]] std::size_t size() const
+    {
+        return items_.size();
+    }
+
 
 private:
 
-    void on_item_accessed(const Key& key)
+    template <typename V>
+    void emplace(const Key& key, V&& value)
     {
-        const auto& [value, iterator] = items_.at(key);
-        keys_.erase(iterator);
+        auto item = items_.find(key);
+        if (item != items_.end())
+        {
+            item->second.first = std::forward<V>(value);
+            on_item_accessed(item->second.second);
+            return;
+        }
+
+        if (items_.size() == capacity_)
+        {
+            auto least_recently_used = keys_.front();
+            keys_.pop_front();
+            items_.erase(least_recently_used);
+        }
+
         keys_.push_back(key);
         auto end_iterator = keys_.end();
         std::advance(end_iterator, -1);
-        items_.insert({key, {value, end_iterator}});
+        items_.insert({key, {std::forward<V>(value), end_iterator}});
+    }
+
+    // Splicing relinks the node in place, so the iterator stored in `items_` stays valid
+    // and neither container allocates on a hit.
+
+    void on_item_accessed(ListIterator iterator)
+    {
+        keys_.splice(keys_.end(), keys_, iterator);
     }
 
     std::size_t capacity_{ };
     std::list<Key> keys_{ };
     std::unordered_map<Key, std::pair<Value, ListIterator>> items_{ };
-};
\ No newline at end of file
+};
+
+
+// Splits the key space into independent LeastRecentlyUsedCache shards, each behind its own lock,
+// so threads touching different shards never contend. Recency is tracked per shard, hence
+// eviction is only approximately LRU across the whole cache.
+
+// The capacity is split exactly across the shards, so the cache never holds more than asked
+// for. A cache smaller than `shard_count` gets one shard per entry instead.
+
+template <typename Key, typename Value, typename Hasher = std::hash<Key>, typename Lock = std::mutex>
+class ShardedLeastRecentlyUsedCache
+{
+public:
+
+    explicit ShardedLeastRecentlyUsedCache(std::size_t capacity, std::size_t shard_count = 16)
+    : shard_count_{ validated_shard_count(capacity, shard_count) }
+    , shards_{ std::make_unique<Shard[]>(shard_count_) }
+    {
+        for (std::size_t i{ 0 }; i < shard_count_; i++)
+        {
+            auto shard_capacity = capacity / shard_count_ + (i < capacity % shard_count_ ? 1 : 0);
+            shards_[i].cache_ = LeastRecentlyUsedCache<Key, Value>(shard_capacity);
+        }
+    }
+
+    ShardedLeastRecentlyUsedCache(const ShardedLeastRecentlyUsedCache&) = delete;
+    ShardedLeastRecentlyUsedCache& operator=(const ShardedLeastRecentlyUsedCache&) = delete;
+
+    bool try_get(const Key& key, Value& value)
+    {
+        auto& shard = get_shard(key);
+        std::scoped_lock lock{ shard.lock_ };
+        return shard.cache_.try_get(key, value);
+    }
+
+    void add(const Key& key, const Value& value)
+    {
+        auto& shard = get_shard(key);
+        std::scoped_lock lock{ shard.lock_ };
+        shard.cache_.add(key, value);
+    }
+
+    void add(const Key& key, Value&& value)
+    {
+        auto& shard = get_shard(key);
+        std::scoped_lock lock{ shard.lock_ };
+        shard.cache_.add(key, std::move(value));
+    }
+
+    // Concurrent misses on the same key are coalesced: the first caller runs `compute`
+    // outside of the shard lock, the others wait on its result. An exception thrown by
+    // `compute` is rethrown in every waiting caller and nothing is cached.
+
+    template <typename Compute>
+    Value get_or_compute(const Key& key, Compute&& compute)
+    {
+        auto& shard = get_shard(key);
+        std::promise<Value> promise;
+        {
+            std::unique_lock lock{ shard.lock_ };
+
+            if (auto value = shard.cache_.try_get(key))
+                return std::move(*value);
+
+            auto pending = shard.pending_.find(key);
+            if (pending != shard.pending_.end())
+            {
+                auto future = pending->second;
+                lock.unlock();
+                return future.get();
+            }
+
+            shard.pending_.insert({ key, promise.get_future().share() });
+        }
+
+        try
+        {
+            Value value = compute(key);
+            {
+                std::scoped_lock lock{ shard.lock_ };
+                shard.cache_.add(key, value);
+                shard.pending_.erase(key);
+            }
+            promise.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            {
+                std::scoped_lock lock{ shard.lock_ };
+                shard.pending_.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        std::size_t size{ 0 };
+        for (std::size_t i{ 0 }; i < shard_count_; i++)
+        {
+            std::scoped_lock lock{ shards_[i].lock_ };
+            size += shards_[i].cache_.size();
+        }
+
+        return size;
+    }
+
+private:
+
+    // Each shard sits on its own cache line so that locking one does not invalidate its neighbours.
+
+    struct alignas(64) Shard
+    {
+        mutable Lock lock_{ };
+        LeastRecentlyUsedCache<Key, Value> cache_{ };
+        std::unordered_map<Key, std::shared_future<Value>> pending_{ };
+    };
+
+    static std::size_t validated_shard_count(std::size_t capacity, std::size_t shard_count)
+    {
+        if (capacity == 0 || shard_count == 0)
+            throw std::invalid_argument("ShardedLeastRecentlyUsedCache capacity and shard count must be positive");
+
+        return std::min(shard_count, capacity);
+    }
+
+    Shard& get_shard(const Key& key)
+    {
+        return shards_[hasher_(key) % shard_count_];
+    }
+
+    Hasher hasher_{ };
+    std::size_t shard_count_{ };
+    std::unique_ptr<Shard[]> shards_{ nullptr };
+};
+
+TEST_CASE( "Sharded cache coalesces concurrent misses.", "[lru]" )
+{
+    auto cache = ShardedLeastRecentlyUsedCache<int, int>(64, 4);
+
+    SECTION("Compute once, then hit.")
+    {
+        int computed = 0;
+        auto compute = [&computed](int key) { computed++; return key * 2; };
+
+        REQUIRE( cache.get_or_compute(21, compute) == 42 );
+        REQUIRE( cache.get_or_compute(21, compute) == 42 );
+        REQUIRE( computed == 1 );
+
+        int value = 0;
+        REQUIRE( cache.try_get(21, value) == true );
+        REQUIRE( value == 42 );
+    }
+
+    SECTION("Failed compute is not cached.")
+    {
+        auto compute = [](int) -> int { throw std::runtime_error("Unavailable"); };
+
+        REQUIRE_THROWS( cache.get_or_compute(1, compute) );
+
+        int value = 0;
+        REQUIRE( cache.try_get(1, value) == false );
+        REQUIRE( cache.size() == 0 );
+    }
+
+    SECTION("Concurrent misses on one key compute once.")
+    {
+        constexpr int Threads = 8;
+        std::atomic<int> computed{ 0 };
+        auto compute = [&computed](int key)
+        {
+            computed++;
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+            return key * 2;
+        };
+
+        std::latch start{ Threads };
+        std::vector<int> results(Threads);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < Threads; i++)
+        {
+            threads.emplace_back([&, i]
+            {
+                start.arrive_and_wait();
+                results[i] = cache.get_or_compute(7, compute);
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        REQUIRE( computed == 1 );
+        REQUIRE( std::count(results.begin(), results.end(), 14) == Threads );
+    }
+}
+
+TEST_CASE( "Sharded cache holds no more than its capacity.", "[lru]" )
+{
+    REQUIRE_THROWS_AS( (ShardedLeastRecentlyUsedCache<int, int>(8, 0)), std::invalid_argument );
+    REQUIRE_THROWS_AS( (ShardedLeastRecentlyUsedCache<int, int>(0, 4)), std::invalid_argument );
+
+    auto cache = ShardedLeastRecentlyUsedCache<int, int>(3, 16);
+    for (int key = 0; key < 100; key++)
+        cache.add(key, key);
+
+    REQUIRE( cache.size() <= 3 );
+}
+
+TEST_CASE( "Sharded cache stores values without a default constructor.", "[lru]" )
+{
+    struct Boxed
+    {
+        explicit Boxed(int value) : value_{ value } { }
+        int value_{ };
+    };
+
+    auto cache = ShardedLeastRecentlyUsedCache<int, Boxed>(8, 2);
+    int computed = 0;
+    auto compute = [&computed](int key) { computed++; return Boxed{ key * 2 }; };
+
+    REQUIRE( cache.get_or_compute(5, compute).value_ == 10 );
+    REQUIRE( cache.get_or_compute(5, compute).value_ == 10 );
+    REQUIRE( computed == 1 );
+}
+
+// `readers - 1` background threads and the measured one look up keys that are all cached, so
+// the cost that grows with the thread count is contention on the shard locks.
+
+template <typename Cache>
+void ReadHeavy(Cache& cache, int keys, unsigned int readers, Catch::Benchmark::Chronometer meter)
+{
+    for (int key = 0; key < keys; key++)
+        cache.add(key, key);
+
+    std::vector<std::jthread> threads{ };
+    for (unsigned int t{ 1 }; t < readers; t++)
+    {
+        threads.emplace_back([&cache, keys, t](std::stop_token stop)
+        {
+            int value = 0;
+            for (int key = static_cast<int>(t); !stop.stop_requested(); key = (key + 7) % keys)
+                cache.try_get(key, value);
+        });
+    }
+
+    int key = 0;
+    meter.measure([&cache, &key, keys]
+    {
+        int value = 0;
+        key = (key + 7) % keys;
+        cache.try_get(key, value);
+        return value;
+    });
+}
+
+TEST_CASE( "Sharded cache read-heavy scaling.", "[lru][!benchmark]" )
+{
+    constexpr int Keys = 4'096;
+
+    for (unsigned int threads{ 1 }; threads <= 16; threads *= 2)
+    {
+        auto suffix = ", " + std::to_string(threads) + " threads";
+
+        BENCHMARK_ADVANCED( "One shard" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            auto cache = ShardedLeastRecentlyUsedCache<int, int>(Keys, 1);
+            ReadHeavy(cache, Keys, threads, meter);
+        };
+
+        BENCHMARK_ADVANCED( "16 shards" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            auto cache = ShardedLeastRecentlyUsedCache<int, int>(Keys, 16);
+            ReadHeavy(cache, Keys, threads, meter);
+        };
+    }
+}
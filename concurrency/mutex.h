@@ -1,7 +1,33 @@
+#pragma once
+
 #include <thread>
+#include <atomic>
+#include <cstdint>
+#include <utility>
 
+#include "futex.h"
 
-class Mutex
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+// Tells the core we are spinning: on x86 this frees pipeline resources for the sibling
+// hyperthread and avoids the memory-order mis-speculation penalty when the spin ends.
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Test-and-test-and-set spinlock. Never sleeps, so only suited to very short critical
+// sections on threads that are not oversubscribed.
+
+class SpinLock
 {
 public:
 
@@ -14,6 +40,11 @@ public:
         }
     }
 
+    bool try_lock()
+    {
+        return !flag_.load(std::memory_order_relaxed) && !flag_.exchange(1, std::memory_order_acquire);
+    }
+
     void unlock()
     {
         flag_.store(0, std::memory_order_release);
@@ -22,4 +53,256 @@ public:
 private:
 
     std::atomic<unsigned int> flag_{ 0 };
-};
\ No newline at end of file
+};
+
+// Adaptive mutex after Drepper's "Futexes Are Tricky": the state is 0 (unlocked), 1 (locked)
+// or 2 (locked, threads may be parked). Uncontended lock and unlock are one atomic operation
+// each and never enter the kernel. A contended lock spins for a bounded time with
+// exponentially growing pauses, since most critical sections end within that window, and then
+// parks on a futex. Unlock only issues a wake-up when the state says someone may be parked.
+
+// Not fair: a running thread can take the lock ahead of one that has just been woken.
+
+class Mutex
+{
+public:
+
+    void lock()
+    {
+        std::uint32_t state{ Unlocked };
+        if (state_.compare_exchange_strong(state, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+
+        LockContended(state);
+    }
+
+    bool try_lock()
+    {
+        std::uint32_t state{ Unlocked };
+        return state_.compare_exchange_strong(state, Locked, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        if (state_.exchange(Unlocked, std::memory_order_release) == Contended)
+            Wake();
+    }
+
+private:
+
+    static constexpr std::uint32_t Unlocked{ 0 };
+    static constexpr std::uint32_t Locked{ 1 };
+    static constexpr std::uint32_t Contended{ 2 };
+
+    // About 2^9 pauses in total, a few microseconds on current x86.
+    static constexpr unsigned int MaxBackoff{ 256 };
+
+    void LockContended(std::uint32_t state)
+    {
+        for (unsigned int backoff{ 1 }; backoff <= MaxBackoff && state != Contended; backoff *= 2)
+        {
+            for (unsigned int i{ 0 }; i < backoff; i++)
+                CpuRelax();
+
+            state = state_.load(std::memory_order_relaxed);
+            if (state == Unlocked && state_.compare_exchange_strong(state, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+
+        // Taking the lock as Contended, rather than Locked, is conservative: we cannot tell
+        // whether other threads are still parked, so our unlock must wake one.
+
+        if (state != Contended)
+            state = state_.exchange(Contended, std::memory_order_acquire);
+
+        while (state != Unlocked)
+        {
+            Wait(Contended);
+            state = state_.exchange(Contended, std::memory_order_acquire);
+        }
+    }
+
+    void Wait(std::uint32_t expected)
+    {
+        FutexWait(state_, expected);
+    }
+
+    void Wake()
+    {
+        FutexWake(state_, 1);
+    }
+
+    std::atomic<std::uint32_t> state_{ Unlocked };
+};
+
+
+// The locks below are fair (FIFO), at the price of never sleeping: a waiter whose predecessor
+// has been preempted spins until that thread runs again. Use them when lock holders are not
+// oversubscribed.
+
+// Ticket lock: one fetch_add to take a ticket, then wait for it to be served. The two counters
+// are on separate cache lines, so arriving threads do not disturb the ones already waiting, and
+// each waiter backs off in proportion to its distance from the head of the queue.
+
+class TicketLock
+{
+public:
+
+    void lock()
+    {
+        auto ticket = next_.fetch_add(1, std::memory_order_relaxed);
+        while (true)
+        {
+            auto serving = serving_.load(std::memory_order_acquire);
+            if (serving == ticket)
+                return;
+
+            for (std::uint32_t i{ 0 }; i < (ticket - serving) * BackoffPerWaiter; i++)
+                CpuRelax();
+        }
+    }
+
+    bool try_lock()
+    {
+        auto serving = serving_.load(std::memory_order_acquire);
+        auto ticket = serving;
+        return next_.compare_exchange_strong(ticket, serving + 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+
+    static constexpr std::uint32_t BackoffPerWaiter{ 32 };
+
+    alignas(64) std::atomic<std::uint32_t> next_{ 0 };
+    alignas(64) std::atomic<std::uint32_t> serving_{ 0 };
+};
+
+// MCS queue lock (Mellor-Crummey and Scott). Each waiter appends its own node to the queue
+// with a single exchange on the tail and spins on a flag in that node, so every waiter spins
+// on its own cache line and a release touches only the successor's line.
+
+// Nodes come from a per-thread free list and go back to it once unlock has handed over, so
+// a thread may hold any number of McsLocks, released in any order, without allocating.
+
+class McsLock
+{
+public:
+
+    McsLock() = default;
+
+    McsLock(const McsLock&) = delete;
+    McsLock& operator=(const McsLock&) = delete;
+
+    void lock()
+    {
+        auto* node = NodePool::acquire();
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        node->locked_.store(true, std::memory_order_relaxed);
+
+        auto* predecessor = tail_.exchange(node, std::memory_order_acq_rel);
+        if (predecessor != nullptr)
+        {
+            predecessor->next_.store(node, std::memory_order_release);
+            while (node->locked_.load(std::memory_order_acquire))
+                CpuRelax();
+        }
+
+        owner_ = node;
+    }
+
+    bool try_lock()
+    {
+        auto* node = NodePool::acquire();
+        node->next_.store(nullptr, std::memory_order_relaxed);
+
+        Node* expected{ nullptr };
+        if (!tail_.compare_exchange_strong(expected, node, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            NodePool::release(node);
+            return false;
+        }
+
+        owner_ = node;
+        return true;
+    }
+
+    void unlock()
+    {
+        auto* node = owner_;
+        auto* successor = node->next_.load(std::memory_order_acquire);
+        if (successor == nullptr)
+        {
+            auto* expected = node;
+            if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+            {
+                NodePool::release(node);
+                return;
+            }
+
+            // A successor has swapped itself in but not linked itself to us yet.
+            while ((successor = node->next_.load(std::memory_order_acquire)) == nullptr)
+                CpuRelax();
+        }
+
+        successor->locked_.store(false, std::memory_order_release);
+        NodePool::release(node);
+    }
+
+private:
+
+    struct alignas(64) Node
+    {
+        std::atomic<Node*> next_{ nullptr };
+        std::atomic<bool> locked_{ false };
+        Node* free_{ nullptr };
+    };
+
+    class NodePool
+    {
+    public:
+
+        static Node* acquire()
+        {
+            auto& pool = Local();
+            if (pool.free_ == nullptr)
+                return new Node{ };
+
+            auto* node = pool.free_;
+            pool.free_ = node->free_;
+            return node;
+        }
+
+        static void release(Node* node)
+        {
+            auto& pool = Local();
+            node->free_ = pool.free_;
+            pool.free_ = node;
+        }
+
+        ~NodePool()
+        {
+            while (free_ != nullptr)
+                delete std::exchange(free_, free_->free_);
+        }
+
+    private:
+
+        static NodePool& Local()
+        {
+            thread_local NodePool pool{ };
+            return pool;
+        }
+
+        Node* free_{ nullptr };
+    };
+
+    std::atomic<Node*> tail_{ nullptr };
+
+    // Written by the holder only, after acquiring.
+    Node* owner_{ nullptr };
+};
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iterator>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include "thread-pool.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Parallel loops over [begin, end) built on ThreadPool::post. The calling thread always runs
+// the first piece itself and then waits; on a pool worker waiting runs other queued tasks, so
+// the algorithms nest.
+
+// Splitting is adaptive (after TBB's auto partitioner): a range is halved, with the right half
+// posted, only while it is larger than `grain` and its split budget lasts. Each halving spends
+// one unit, so a budget of b yields up to 2^b pieces; the initial budget is ceil(log2(4 *
+// workers)), for four to eight pieces per worker. A piece that was stolen by another thread
+// gets extra budget, since a steal means some worker ran dry and wants more, smaller pieces.
+
+// Outstanding pieces are counted in a TaskState so that waiting reuses TaskHandle's helping
+// wait. The first exception thrown by `body` cancels the pieces that have not started yet and
+// is rethrown to the caller.
+
+template <typename Body>
+class ParallelLoop : public TaskState<void>
+{
+public:
+
+    // Calls `body(chunk_begin, chunk_end)` on disjoint chunks covering [begin, end).
+
+    static void run(ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, Body& body)
+    {
+        if (begin >= end)
+            return;
+
+        auto loop = std::make_shared<ParallelLoop>(pool, body, std::max<std::size_t>(grain, 1));
+        RunPiece(loop, begin, end, static_cast<unsigned int>(std::bit_width(4 * pool.size() - 1)));
+        loop->Done();
+
+        TaskHandle<void>{ std::move(loop) }.get();
+    }
+
+    ParallelLoop(ThreadPool& pool, Body& body, std::size_t grain)
+    : pool_{ pool }
+    , body_{ body }
+    , grain_{ grain }
+    {
+        set_pool(&pool);
+    }
+
+private:
+
+    static void RunPiece(const std::shared_ptr<ParallelLoop>& loop, std::size_t begin, std::size_t end, unsigned int budget)
+    {
+        while (end - begin > loop->grain_ && budget > 0)
+        {
+            auto middle = begin + (end - begin) / 2;
+            budget--;
+
+            loop->pending_.fetch_add(1, std::memory_order_relaxed);
+            loop->pool_.post([loop, middle, end, budget, owner = std::this_thread::get_id()]
+            {
+                auto stolen = std::this_thread::get_id() != owner;
+                RunPiece(loop, middle, end, stolen ? budget + 2 : budget);
+                loop->Done();
+            });
+
+            end = middle;
+        }
+
+        if (loop->failed_.load(std::memory_order_relaxed))
+            return;
+
+        try
+        {
+            loop->body_(begin, end);
+        }
+        catch (...)
+        {
+            if (!loop->failed_.exchange(true, std::memory_order_acq_rel))
+                loop->exception_ = std::current_exception();
+        }
+    }
+
+    void Done()
+    {
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            complete();
+    }
+
+    ThreadPool& pool_;
+    Body& body_;
+    std::size_t grain_{ };
+    std::atomic<std::size_t> pending_{ 1 };
+    std::atomic<bool> failed_{ false };
+};
+
+template <typename Body>
+void parallel_chunks(ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, Body&& body)
+{
+    ParallelLoop<std::remove_reference_t<Body>>::run(pool, begin, end, grain, body);
+}
+
+template <typename Function>
+void parallel_for(ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, Function&& function)
+{
+    parallel_chunks(pool, begin, end, grain, [&function](std::size_t chunk_begin, std::size_t chunk_end)
+    {
+        for (auto i = chunk_begin; i < chunk_end; i++)
+            function(i);
+    });
+}
+
+// Reduces `map(i)` over [begin, end) with `reduce`, which must be associative and commutative:
+// each thread folds its pieces into its own slot, and the slots are combined in index order at
+// the end. Slots are padded to a cache line so that threads never write to a shared line.
+
+template <typename T, typename Reduce, typename Map>
+T parallel_reduce(ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, T identity, Reduce&& reduce, Map&& map)
+{
+    struct alignas(64) Slot
+    {
+        T value_;
+    };
+
+    // One slot per worker, plus one for the calling thread if it is not a worker.
+    std::vector<Slot> slots(pool.size() + 1, Slot{ identity });
+
+    parallel_chunks(pool, begin, end, grain, [&](std::size_t chunk_begin, std::size_t chunk_end)
+    {
+        T local = identity;
+        for (auto i = chunk_begin; i < chunk_end; i++)
+            local = reduce(std::move(local), map(i));
+
+        auto& slot = slots[pool.worker_index().value_or(pool.size())];
+        slot.value_ = reduce(std::move(slot.value_), std::move(local));
+    });
+
+    T result = std::move(identity);
+    for (auto& slot : slots)
+        result = reduce(std::move(result), std::move(slot.value_));
+
+    return result;
+}
+
+// Chunks index into both ranges, so both need random access; `output` must already hold
+// `last - first` elements.
+
+template <std::random_access_iterator RandomIterator, std::random_access_iterator RandomOutputIterator, typename Function>
+RandomOutputIterator parallel_transform(ThreadPool& pool, RandomIterator first, RandomIterator last, RandomOutputIterator output, std::size_t grain, Function&& function)
+{
+    auto count = static_cast<std::size_t>(std::distance(first, last));
+
+    parallel_chunks(pool, 0, count, grain, [&](std::size_t chunk_begin, std::size_t chunk_end)
+    {
+        std::transform(first + chunk_begin, first + chunk_end, output + chunk_begin, function);
+    });
+
+    return output + count;
+}
+
+// Sorts about four chunks per worker in parallel, then merges neighbouring runs pairwise, each
+// round in parallel, until one run is left. Not stable.
+
+template <typename RandomIterator, typename Compare = std::less<>>
+void parallel_sort(ThreadPool& pool, RandomIterator first, RandomIterator last, std::size_t grain = 4096, Compare compare = Compare{ })
+{
+    auto count = static_cast<std::size_t>(std::distance(first, last));
+    grain = std::max<std::size_t>(grain, 1);
+
+    auto chunks = std::min<std::size_t>((count + grain - 1) / grain, 4 * pool.size());
+    if (chunks <= 1)
+    {
+        std::sort(first, last, compare);
+        return;
+    }
+
+    auto boundary = [count, chunks](std::size_t chunk) { return std::min(count, chunk * count / chunks); };
+
+    parallel_for(pool, 0, chunks, 1, [&](std::size_t chunk)
+    {
+        std::sort(first + boundary(chunk), first + boundary(chunk + 1), compare);
+    });
+
+    for (std::size_t width{ 1 }; width < chunks; width *= 2)
+    {
+        auto pairs = (chunks + 2 * width - 1) / (2 * width);
+        parallel_for(pool, 0, pairs, 1, [&](std::size_t pair)
+        {
+            auto low = pair * 2 * width;
+            auto middle = std::min(low + width, chunks);
+            auto high = std::min(low + 2 * width, chunks);
+            if (middle < high)
+                std::inplace_merge(first + boundary(low), first + boundary(middle), first + boundary(high), compare);
+        });
+    }
+}
+
+
+TEST_CASE( "Parallel loops cover the range exactly once.", "[parallel_algorithms]" )
+{
+    ThreadPool pool{ 4 };
+
+    SECTION( "parallel_for visits every index once." )
+    {
+        std::vector<int> visits(10'000, 0);
+        parallel_for(pool, 0, visits.size(), 16, [&visits](std::size_t i) { visits[i]++; });
+
+        REQUIRE( std::count(visits.begin(), visits.end(), 1) == 10'000 );
+    }
+
+    SECTION( "An empty range calls nothing." )
+    {
+        bool called = false;
+        parallel_for(pool, 5, 5, 1, [&called](std::size_t) { called = true; });
+        parallel_for(pool, 6, 5, 1, [&called](std::size_t) { called = true; });
+
+        REQUIRE( called == false );
+    }
+
+    SECTION( "A grain larger than the range runs it as one chunk." )
+    {
+        std::atomic<int> chunks{ 0 };
+        parallel_chunks(pool, 0, 100, 1000, [&chunks](std::size_t begin, std::size_t end)
+        {
+            chunks++;
+            REQUIRE( begin == 0 );
+            REQUIRE( end == 100 );
+        });
+
+        REQUIRE( chunks == 1 );
+    }
+
+    SECTION( "The first exception is rethrown to the caller." )
+    {
+        REQUIRE_THROWS_AS( parallel_for(pool, 0, 1000, 1, [](std::size_t i) { if (i == 500) throw std::runtime_error("failed"); }), std::runtime_error );
+    }
+}
+
+TEST_CASE( "parallel_reduce and parallel_transform match their serial versions.", "[parallel_algorithms]" )
+{
+    ThreadPool pool{ 4 };
+    auto plus = [](long a, long b) { return a + b; };
+    auto identity = [](std::size_t i) { return static_cast<long>(i); };
+
+    REQUIRE( parallel_reduce(pool, 0, 100'000, 64, 0L, plus, identity) == 100'000L * 99'999 / 2 );
+    REQUIRE( parallel_reduce(pool, 0, 100, 1000, 0L, plus, identity) == 4950 );
+    REQUIRE( parallel_reduce(pool, 0, 0, 1, 0L, plus, identity) == 0 );
+
+    std::vector<int> input(5000);
+    std::iota(input.begin(), input.end(), 0);
+    std::vector<int> output(input.size());
+
+    auto end = parallel_transform(pool, input.begin(), input.end(), output.begin(), 32, [](int x) { return x * x; });
+
+    REQUIRE( end == output.end() );
+    for (std::size_t i = 0; i < input.size(); i++)
+        REQUIRE( output[i] == input[i] * input[i] );
+
+    REQUIRE( parallel_transform(pool, input.begin(), input.begin(), output.begin(), 32, [](int x) { return x; }) == output.begin() );
+}
+
+TEST_CASE( "parallel_sort orders the range.", "[parallel_algorithms]" )
+{
+    ThreadPool pool{ 4 };
+    std::mt19937 random{ 42 };
+
+    for (std::size_t count : { 0, 1, 100, 4096, 100'000 })
+    {
+        std::vector<int> values(count);
+        for (auto& value : values)
+            value = static_cast<int>(random() % 1000);
+
+        auto expected = values;
+        std::sort(expected.begin(), expected.end(), std::greater<>{ });
+        parallel_sort(pool, values.begin(), values.end(), 1000, std::greater<>{ });
+
+        REQUIRE( values == expected );
+    }
+}
+
+TEST_CASE( "Parallel algorithms nest inside pool tasks.", "[parallel_algorithms]" )
+{
+    ThreadPool pool{ 2 };
+
+    auto sum = pool.submit([&pool]
+    {
+        std::vector<long> rows(64, 0);
+        parallel_for(pool, 0, rows.size(), 1, [&](std::size_t row)
+        {
+            rows[row] = parallel_reduce(pool, 0, 1000, 10, 0L, std::plus<>{ }, [](std::size_t i) { return static_cast<long>(i); });
+        });
+
+        return std::accumulate(rows.begin(), rows.end(), 0L);
+    });
+
+    REQUIRE( sum.get() == 64L * 999 * 1000 / 2 );
+}
@@ -1,83 +1,745 @@
+#pragma once
+
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <limits>
+#include <bit>
+#include <cstdint>
+#include <algorithm>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "mutex.h"
+#include "futex.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+#include <catch2/benchmark/catch_benchmark.hpp> // For benchmarking.
+
+
+// Reader-biased lock for read-mostly data. A reader only increments and decrements a counter
+// in its own slot, each slot on its own cache line, so readers on different threads never
+// write to a shared line. A writer, serialized with other writers by a Mutex, raises `writer_`
+// and waits for every slot to drain; readers that find `writer_` raised back out of their slot
+// and sleep on it until the writer is done. As with Mutex, `writer_` is 0 (no writer),
+// 1 (writer) or 2 (writer, readers may be asleep), so an unlock only wakes when it is 2.
+
+// The writer spins on a slot for SpinCount rounds, then sleeps on its counter; a reader that
+// empties a slot while `writer_` is raised wakes it. Readers pay one load of `writer_` on
+// unlock for this, on a line that only writers write.
+
+// Readers are assigned slots per thread, so a shared lock must be released by the thread that
+// took it (as for std::shared_mutex). Writes cost a scan of all slots and should be rare.
+
+// lock/unlock/try_lock and lock_shared/unlock_shared/try_lock_shared make it usable with
+// std::unique_lock and std::shared_lock.
 
 class ReaderWriterLock
 {
 public:
 
-    void ReaderLock()
+    ReaderWriterLock()
+    : slot_count_{ std::bit_ceil(std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MaxSlots)) }
+    , slots_{ std::make_unique<Slot[]>(slot_count_) }
     {
-        std::unique_lock lock{ mutex_ };
+    }
 
-        if (writing_)
+    ReaderWriterLock(const ReaderWriterLock&) = delete;
+    ReaderWriterLock& operator=(const ReaderWriterLock&) = delete;
+
+    void ReaderLock()
+    {
+        auto& readers = slots_[ThreadIndex() & (slot_count_ - 1)].readers_;
+        while (true)
         {
-            readers_queued_++;
-            readers_ready_.wait(lock, [this] { return !writing_; });
-            readers_queued_--;
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            if (writer_.load(std::memory_order_seq_cst) == 0)
+                return;
+
+            LeaveSlot(readers);
+            WaitForWriter();
         }
+    }
 
-        readers_++;
+    bool TryReaderLock()
+    {
+        auto& readers = slots_[ThreadIndex() & (slot_count_ - 1)].readers_;
+
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        if (writer_.load(std::memory_order_seq_cst) == 0)
+            return true;
+
+        LeaveSlot(readers);
+        return false;
     }
-    void ReaderUnlock() 
-    { 
-        std::unique_lock lock{ mutex_ };
 
-        if (--readers_ == 0)
+    void ReaderUnlock()
+    {
+        LeaveSlot(slots_[ThreadIndex() & (slot_count_ - 1)].readers_);
+    }
+
+    void WriterLock()
+    {
+        writers_.lock();
+        writer_.store(Writing, std::memory_order_seq_cst);
+
+        for (std::size_t i{ 0 }; i < slot_count_; i++)
         {
-            if (writers_queued_ > 0)
+            auto& readers = slots_[i].readers_;
+            for (unsigned int spins{ 0 }; ; spins++)
             {
-                lock.unlock();
-                writers_ready_.notify_one();
+                auto count = readers.load(std::memory_order_seq_cst);
+                if (count == 0)
+                    break;
+
+                if (spins < SpinCount)
+                    CpuRelax();
+                else
+                    FutexWait(readers, count);
             }
         }
     }
 
-    void WriterLock() 
-    { 
-        std::unique_lock lock{ mutex_ };
+    bool TryWriterLock()
+    {
+        if (!writers_.try_lock())
+            return false;
+
+        writer_.store(Writing, std::memory_order_seq_cst);
 
-        if (readers_ > 0)
+        for (std::size_t i{ 0 }; i < slot_count_; i++)
         {
-            writers_queued_++;
-            writers_ready_.wait(lock, [this] { return readers_ == 0 && !writing_; });
-            writers_queued_--;
+            if (slots_[i].readers_.load(std::memory_order_seq_cst) != 0)
+            {
+                WriterUnlock();
+                return false;
+            }
         }
 
-        writing_ = true;
+        return true;
     }
 
     void WriterUnlock()
-    { 
+    {
+        if (writer_.exchange(NoWriter, std::memory_order_release) == WritingWithSleepers)
+            FutexWake(writer_, std::numeric_limits<int>::max());
+
+        writers_.unlock();
+    }
+
+    void lock() { WriterLock(); }
+    bool try_lock() { return TryWriterLock(); }
+    void unlock() { WriterUnlock(); }
+
+    void lock_shared() { ReaderLock(); }
+    bool try_lock_shared() { return TryReaderLock(); }
+    void unlock_shared() { ReaderUnlock(); }
+
+private:
+
+    static constexpr std::size_t MaxSlots{ 256 };
+    static constexpr unsigned int SpinCount{ 1024 };
+
+    static constexpr std::uint32_t NoWriter{ 0 };
+    static constexpr std::uint32_t Writing{ 1 };
+    static constexpr std::uint32_t WritingWithSleepers{ 2 };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<std::uint32_t> readers_{ 0 };
+    };
+
+    // The decrement and the load of `writer_` pair with the writer's store of `writer_` and
+    // load of the slot: either the writer sees the slot empty, or this reader sees the writer.
+
+    void LeaveSlot(std::atomic<std::uint32_t>& readers)
+    {
+        if (readers.fetch_sub(1, std::memory_order_seq_cst) == 1 && writer_.load(std::memory_order_seq_cst) != NoWriter)
+            FutexWake(readers, 1);
+    }
+
+    // Marks the writer as having sleepers before sleeping, so its unlock knows to wake them.
+
+    void WaitForWriter()
+    {
+        auto state = writer_.load(std::memory_order_acquire);
+        while (state != NoWriter)
+        {
+            if (state == Writing && !writer_.compare_exchange_weak(state, WritingWithSleepers, std::memory_order_acquire, std::memory_order_acquire))
+                continue;
+
+            FutexWait(writer_, WritingWithSleepers);
+            state = writer_.load(std::memory_order_acquire);
+        }
+    }
+
+    // Threads take consecutive indices, so up to slot_count_ threads get a slot of their own.
+
+    static std::size_t ThreadIndex()
+    {
+        static std::atomic<std::size_t> next{ 0 };
+        thread_local std::size_t index{ next.fetch_add(1, std::memory_order_relaxed) };
+        return index;
+    }
+
+    std::size_t slot_count_{ };
+    std::unique_ptr<Slot[]> slots_{ nullptr };
+
+    alignas(64) std::atomic<std::uint32_t> writer_{ NoWriter };
+    Mutex writers_{ };
+};
+
+
+// Who goes first when readers and writers compete for an UpgradeableReaderWriterLock:
+//  - ReaderPreferring: readers enter whenever no writer holds the lock; writers can starve.
+//  - WriterPreferring: a waiting writer blocks new readers; readers can starve.
+//  - PhaseFair: read and write phases alternate (Brandenburg and Anderson). Readers blocked by
+//    a writer all enter when it unlocks, ahead of the next writer, so neither side waits for
+//    more than one phase of the other.
+
+enum class ReaderWriterPolicy
+{
+    ReaderPreferring,
+    WriterPreferring,
+    PhaseFair,
+};
+
+// Reader-writer lock with a selectable policy and an upgradeable read mode. An upgradeable
+// holder reads alongside ordinary readers, but only one may exist at a time, so it can later
+// turn its hold into a write lock without releasing it, and without deadlocking against
+// another upgrader: a cache fill can look up under lock_upgrade and, on a miss,
+// unlock_upgrade_and_lock and insert, with no second lookup.
+
+// Built on a std::mutex and condition variables, so it suits locks held for a while rather
+// than read-mostly hot paths (see ReaderWriterLock).
+
+template <ReaderWriterPolicy Policy = ReaderWriterPolicy::PhaseFair>
+class UpgradeableReaderWriterLock
+{
+public:
+
+    UpgradeableReaderWriterLock() = default;
+
+    UpgradeableReaderWriterLock(const UpgradeableReaderWriterLock&) = delete;
+    UpgradeableReaderWriterLock& operator=(const UpgradeableReaderWriterLock&) = delete;
+
+    void lock_shared()
+    {
+        std::unique_lock lock{ mutex_ };
+        EnterShared(lock, false);
+    }
+
+    bool try_lock_shared()
+    {
+        std::scoped_lock lock{ mutex_ };
+        if (!ReaderMayEnter(write_phase_))
+            return false;
+
+        readers_++;
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        std::unique_lock lock{ mutex_ };
+        LeaveShared(lock);
+    }
+
+    void lock()
+    {
         std::unique_lock lock{ mutex_ };
-        
-        writing_ = false;
 
-        if (writers_queued_ > 0)
+        writers_waiting_++;
+        writers_ready_.wait(lock, [this] { return WriterMayEnter(); });
+        writers_waiting_--;
+
+        writing_ = true;
+    }
+
+    bool try_lock()
+    {
+        std::scoped_lock lock{ mutex_ };
+        if (!WriterMayEnter())
+            return false;
+
+        writing_ = true;
+        return true;
+    }
+
+    void unlock()
+    {
         {
-            lock.unlock();
-            writers_ready_.notify_one();
+            std::scoped_lock lock{ mutex_ };
+
+            writing_ = false;
+            write_phase_++;
+            released_readers_ = readers_waiting_;
         }
-        else
+
+        readers_ready_.notify_all();
+        writers_ready_.notify_all();
+    }
+
+    void lock_upgrade()
+    {
+        std::unique_lock lock{ mutex_ };
+        EnterShared(lock, true);
+    }
+
+    void unlock_upgrade()
+    {
+        std::unique_lock lock{ mutex_ };
+
+        upgrading_ = false;
+        LeaveShared(lock);
+        readers_ready_.notify_all();
+    }
+
+    // Waits for the other readers to leave while still counted as a reader itself, so no
+    // writer can get in between.
+
+    void unlock_upgrade_and_lock()
+    {
+        std::unique_lock lock{ mutex_ };
+
+        writers_waiting_++;
+        writers_ready_.wait(lock, [this] { return readers_ == 1; });
+        writers_waiting_--;
+
+        readers_--;
+        upgrading_ = false;
+        writing_ = true;
+    }
+
+    // Downgrades a write lock to an upgradeable one; other readers may enter again.
+
+    void unlock_and_lock_upgrade()
+    {
         {
-            if (readers_queued_ > 0)
-            {
-                lock.unlock();
-                readers_ready_.notify_all();
-            }
+            std::scoped_lock lock{ mutex_ };
+
+            writing_ = false;
+            write_phase_++;
+            released_readers_ = readers_waiting_;
+            upgrading_ = true;
+            readers_++;
         }
+
+        readers_ready_.notify_all();
     }
 
 private:
 
+    bool ReaderMayEnter(std::uint64_t arrival_phase) const
+    {
+        if (writing_)
+            return false;
+
+        if constexpr (Policy == ReaderWriterPolicy::ReaderPreferring)
+            return true;
+        else if constexpr (Policy == ReaderWriterPolicy::WriterPreferring)
+            return writers_waiting_ == 0;
+        else
+            return writers_waiting_ == 0 || arrival_phase != write_phase_;
+    }
+
+    bool WriterMayEnter() const
+    {
+        if (writing_ || readers_ > 0)
+            return false;
+
+        if constexpr (Policy == ReaderWriterPolicy::ReaderPreferring)
+            return readers_waiting_ == 0;
+        else if constexpr (Policy == ReaderWriterPolicy::WriterPreferring)
+            return true;
+        else
+            return released_readers_ == 0;
+    }
+
+    void EnterShared(std::unique_lock<std::mutex>& lock, bool upgradeable)
+    {
+        auto arrival_phase = write_phase_;
+        auto may_enter = [this, arrival_phase, upgradeable] { return ReaderMayEnter(arrival_phase) && !(upgradeable && upgrading_); };
+
+        if (!may_enter())
+        {
+            readers_waiting_++;
+            readers_ready_.wait(lock, may_enter);
+            readers_waiting_--;
+
+            if (arrival_phase != write_phase_ && released_readers_ > 0)
+                released_readers_--;
+        }
+
+        readers_++;
+        if (upgradeable)
+            upgrading_ = true;
+    }
+
+    void LeaveShared(std::unique_lock<std::mutex>& lock)
+    {
+        readers_--;
+
+        // Wakes writers, and an upgrader waiting to be the last reader.
+        if (readers_ <= 1 && writers_waiting_ > 0)
+        {
+            lock.unlock();
+            writers_ready_.notify_all();
+        }
+    }
+
     std::mutex mutex_{ };
-    std::condition_variable writers_ready_{ };
     std::condition_variable readers_ready_{ };
-
+    std::condition_variable writers_ready_{ };
 
     unsigned int readers_{ 0 };
+    unsigned int readers_waiting_{ 0 };
+    unsigned int writers_waiting_{ 0 };
+    unsigned int released_readers_{ 0 };
+    std::uint64_t write_phase_{ 0 };
     bool writing_{ false };
-    unsigned int writers_queued_{ 0 };
-    unsigned int readers_queued_{ 0 };
-};
\ No newline at end of file
+    bool upgrading_{ false };
+};
+
+
+// Writers bump both halves of `pair` under the write lock; a reader that ever sees them differ,
+// or a writer that finds anyone else inside, means the lock let two sides in at once.
+
+template <typename Lock>
+void CheckExclusion(Lock& lock, unsigned int readers, unsigned int writers)
+{
+    constexpr int Rounds{ 20'000 };
+
+    std::uint64_t pair[2]{ 0, 0 };
+    std::atomic<int> readers_inside{ 0 };
+    std::atomic<int> writers_inside{ 0 };
+    std::atomic<bool> violated{ false };
+
+    std::vector<std::thread> threads{ };
+    for (unsigned int t{ 0 }; t < readers; t++)
+    {
+        threads.emplace_back([&]
+        {
+            for (int i{ 0 }; i < Rounds; i++)
+            {
+                std::shared_lock guard{ lock };
+                readers_inside++;
+                if (pair[0] != pair[1] || writers_inside.load() != 0)
+                    violated = true;
+                readers_inside--;
+            }
+        });
+    }
+
+    for (unsigned int t{ 0 }; t < writers; t++)
+    {
+        threads.emplace_back([&]
+        {
+            for (int i{ 0 }; i < Rounds / 10; i++)
+            {
+                std::scoped_lock guard{ lock };
+                if (writers_inside++ != 0 || readers_inside.load() != 0)
+                    violated = true;
+                pair[0]++;
+                pair[1]++;
+                writers_inside--;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    REQUIRE( violated == false );
+    REQUIRE( pair[0] == std::uint64_t{ writers } * (Rounds / 10) );
+    REQUIRE( pair[1] == pair[0] );
+}
+
+TEST_CASE( "ReaderWriterLock keeps readers and writers apart.", "[rw_lock]" )
+{
+    ReaderWriterLock lock{ };
+
+    SECTION( "Many readers, one writer." ) { CheckExclusion(lock, 8, 1); }
+    SECTION( "Many readers, several writers." ) { CheckExclusion(lock, 8, 4); }
+    SECTION( "Writers only." ) { CheckExclusion(lock, 0, 4); }
+
+    SECTION( "try_lock fails while a reader holds the lock, and try_lock_shared while a writer does." )
+    {
+        lock.lock_shared();
+        std::jthread{ [&lock] { REQUIRE( lock.try_lock() == false ); } }.join();
+        lock.unlock_shared();
+
+        lock.lock();
+        std::jthread{ [&lock] { REQUIRE( lock.try_lock_shared() == false ); } }.join();
+        lock.unlock();
+
+        REQUIRE( lock.try_lock() == true );
+        lock.unlock();
+    }
+}
+
+// Readers hold the lock briefly in a loop while `writers` threads take it once every few
+// microseconds; the measured thread reads. Slots make ReaderWriterLock scale with readers,
+// where std::shared_mutex has every reader write one shared counter.
+
+template <typename Lock>
+void ReadUnderContention(Lock& lock, unsigned int readers, unsigned int writers, Catch::Benchmark::Chronometer meter)
+{
+    std::uint64_t value{ 0 };
+    std::vector<std::jthread> threads{ };
+    for (unsigned int t{ 0 }; t < readers; t++)
+    {
+        threads.emplace_back([&lock, &value](std::stop_token stop)
+        {
+            while (!stop.stop_requested())
+            {
+                std::shared_lock guard{ lock };
+                (void)value;
+            }
+        });
+    }
+
+    for (unsigned int t{ 0 }; t < writers; t++)
+    {
+        threads.emplace_back([&lock, &value](std::stop_token stop)
+        {
+            while (!stop.stop_requested())
+            {
+                {
+                    std::scoped_lock guard{ lock };
+                    value++;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+    }
+
+    meter.measure([&lock, &value]
+    {
+        std::shared_lock guard{ lock };
+        return value;
+    });
+}
+
+TEST_CASE( "ReaderWriterLock against std::shared_mutex.", "[rw_lock][!benchmark]" )
+{
+    for (unsigned int threads{ 1 }; threads <= 16; threads *= 2)
+    {
+        auto suffix = ", " + std::to_string(threads) + " threads";
+
+        BENCHMARK_ADVANCED( "ReaderWriterLock, readers only" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            ReaderWriterLock lock{ };
+            ReadUnderContention(lock, threads - 1, 0, meter);
+        };
+
+        BENCHMARK_ADVANCED( "std::shared_mutex, readers only" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            std::shared_mutex lock{ };
+            ReadUnderContention(lock, threads - 1, 0, meter);
+        };
+
+        BENCHMARK_ADVANCED( "ReaderWriterLock, one writer" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            ReaderWriterLock lock{ };
+            ReadUnderContention(lock, threads - 1, 1, meter);
+        };
+
+        BENCHMARK_ADVANCED( "std::shared_mutex, one writer" + suffix )(Catch::Benchmark::Chronometer meter)
+        {
+            std::shared_mutex lock{ };
+            ReadUnderContention(lock, threads - 1, 1, meter);
+        };
+    }
+}
+
+// Waits until a writer is queued: with one holding a shared or upgradeable lock, a waiting
+// writer is the only thing that makes try_lock_shared fail under PhaseFair.
+
+template <typename Lock>
+void WaitForQueuedWriter(Lock& lock)
+{
+    while (lock.try_lock_shared())
+    {
+        lock.unlock_shared();
+        std::this_thread::yield();
+    }
+}
+
+TEST_CASE( "UpgradeableReaderWriterLock upgrades and downgrades in place.", "[rw_lock]" )
+{
+    UpgradeableReaderWriterLock<> lock{ };
+    int value = 1;
+
+    SECTION( "No writer gets in between lock_upgrade and unlock_upgrade_and_lock." )
+    {
+        lock.lock_upgrade();
+
+        int seen = 0;
+        std::jthread writer{ [&] { std::scoped_lock guard{ lock }; seen = value; value = 100; } };
+        WaitForQueuedWriter(lock);
+
+        lock.unlock_upgrade_and_lock();
+        REQUIRE( value == 1 );
+        value = 2;
+        lock.unlock();
+
+        writer.join();
+        REQUIRE( seen == 2 );
+        REQUIRE( value == 100 );
+    }
+
+    SECTION( "unlock_and_lock_upgrade lets readers back in but not writers." )
+    {
+        lock.lock();
+        value = 5;
+        lock.unlock_and_lock_upgrade();
+
+        std::jthread{ [&lock]
+        {
+            REQUIRE( lock.try_lock_shared() == true );
+            lock.unlock_shared();
+            REQUIRE( lock.try_lock() == false );
+        } }.join();
+
+        std::atomic<bool> upgraded{ false };
+        std::jthread upgrader{ [&] { lock.lock_upgrade(); upgraded = true; lock.unlock_upgrade(); } };
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        REQUIRE( upgraded == false );
+        REQUIRE( value == 5 );
+
+        lock.unlock_upgrade();
+        upgrader.join();
+        REQUIRE( upgraded == true );
+    }
+
+    SECTION( "Upgraders serialize, alongside ordinary readers." )
+    {
+        constexpr int Rounds{ 500 };
+
+        std::atomic<int> upgraders{ 0 };
+        std::atomic<bool> violated{ false };
+        std::vector<std::jthread> threads{ };
+        for (int t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&]
+            {
+                for (int i = 0; i < Rounds; i++)
+                {
+                    lock.lock_upgrade();
+                    if (upgraders++ != 0)
+                        violated = true;
+
+                    auto before = value;
+                    lock.unlock_upgrade_and_lock();
+                    if (value != before)
+                        violated = true;
+
+                    value++;
+                    upgraders--;
+                    lock.unlock();
+                }
+            });
+        }
+
+        for (int t = 0; t < 2; t++)
+        {
+            threads.emplace_back([&]
+            {
+                for (int i = 0; i < Rounds; i++)
+                {
+                    std::shared_lock guard{ lock };
+                    (void)value;
+                }
+            });
+        }
+
+        threads.clear();
+
+        REQUIRE( violated == false );
+        REQUIRE( value == 1 + 4 * Rounds );
+    }
+}
+
+// Readers hold the lock while writer `first` queues; then a reader and a second writer queue
+// behind `first`. The policy decides who goes when `first` unlocks.
+
+template <ReaderWriterPolicy Policy>
+std::string PhaseOrder()
+{
+    UpgradeableReaderWriterLock<Policy> lock{ };
+    std::mutex mutex;
+    std::string order{ };
+    auto record = [&](char c) { std::scoped_lock guard{ mutex }; order += c; };
+
+    std::atomic<bool> holding{ false };
+    std::atomic<bool> release{ false };
+
+    lock.lock_shared();
+    std::jthread first{ [&] { lock.lock(); holding = true; while (!release) std::this_thread::yield(); record('W'); lock.unlock(); } };
+
+    // Under PhaseFair and WriterPreferring the queued writer also shuts out new readers.
+    if constexpr (Policy != ReaderWriterPolicy::ReaderPreferring)
+        WaitForQueuedWriter(lock);
+    else
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    lock.unlock_shared();
+    while (!holding)
+        std::this_thread::yield();
+
+    std::jthread reader{ [&] { std::shared_lock guard{ lock }; record('r'); } };
+    std::jthread second{ [&] { std::scoped_lock guard{ lock }; record('w'); } };
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    release = true;
+    first.join();
+    reader.join();
+    second.join();
+    return order;
+}
+
+TEST_CASE( "UpgradeableReaderWriterLock policies decide who follows a writer.", "[rw_lock]" )
+{
+    SECTION( "PhaseFair lets the waiting reader in before the next writer." )
+    {
+        REQUIRE( PhaseOrder<ReaderWriterPolicy::PhaseFair>() == "Wrw" );
+    }
+
+    SECTION( "WriterPreferring lets the next writer in first." )
+    {
+        REQUIRE( PhaseOrder<ReaderWriterPolicy::WriterPreferring>() == "Wwr" );
+    }
+
+    SECTION( "ReaderPreferring lets the reader in first." )
+    {
+        REQUIRE( PhaseOrder<ReaderWriterPolicy::ReaderPreferring>() == "Wrw" );
+    }
+
+    SECTION( "PhaseFair alternates under a stream of both." )
+    {
+        UpgradeableReaderWriterLock<ReaderWriterPolicy::PhaseFair> lock{ };
+        std::atomic<int> reads{ 0 };
+        std::atomic<int> writes{ 0 };
+        std::atomic<bool> stop{ false };
+
+        std::vector<std::jthread> threads{ };
+        for (int t = 0; t < 3; t++)
+            threads.emplace_back([&] { while (!stop) { std::shared_lock guard{ lock }; reads++; } });
+        for (int t = 0; t < 2; t++)
+            threads.emplace_back([&] { while (!stop) { std::scoped_lock guard{ lock }; writes++; } });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stop = true;
+        threads.clear();
+
+        REQUIRE( reads > 0 );
+        REQUIRE( writes > 0 );
+    }
+}
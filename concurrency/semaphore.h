@@ -1,29 +1,246 @@
+#pragma once
+
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <type_traits>
+
+#include "futex.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Counting semaphore. Acquiring takes permits with a CAS on the count and, when too few are
+// left, sleeps on a futex on the count. Sleepers register in `waiters_` before their final
+// check, and `release` reads `waiters_` after publishing its permits (both sequentially
+// consistent), so release only makes a syscall when someone may be asleep and never misses one.
 
+// A release of n permits wakes n sleepers, unless a batch acquirer is among them: then it
+// wakes all, since the sleepers it would pick might each need more than was released.
 
 class Semaphore
 {
 public:
 
-    Semaphore(int count = 1)
+    explicit Semaphore(std::uint32_t count = 1)
     : count_{ count }
     {
     }
 
-    void acquire() 
-    { 
-        int count = 0;
-        while ((count = count_.load(std::memory_order_relaxed)) <= 0)
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    void acquire(std::uint32_t permits = 1)
+    {
+        if (try_acquire(permits))
+            return;
+
+        Waiting waiting{ *this, permits };
+        while (true)
+        {
+            auto count = count_.load(std::memory_order_seq_cst);
+            if (TryTake(count, permits))
+                return;
+
+            FutexWait(count_, count);
+        }
+    }
+
+    [[nodiscard]] bool try_acquire(std::uint32_t permits = 1)
+    {
+        auto count = count_.load(std::memory_order_relaxed);
+        return TryTake(count, permits);
+    }
+
+    template <typename Rep, typename Period>
+    [[nodiscard]] bool try_acquire_for(std::chrono::duration<Rep, Period> timeout, std::uint32_t permits = 1)
+    {
+        if (try_acquire(permits))
+            return true;
+
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        Waiting waiting{ *this, permits };
+        while (true)
         {
-            if (count_.compare_exchange_strong(count, count - 1, std::memory_order_acq_rel))
-                break;
+            auto count = count_.load(std::memory_order_seq_cst);
+            if (TryTake(count, permits))
+                return true;
+
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (!FutexWaitFor(count_, count, std::chrono::duration_cast<std::chrono::nanoseconds>(remaining)))
+            {
+                count = count_.load(std::memory_order_relaxed);
+                return TryTake(count, permits);
+            }
         }
     }
-    void release() 
-    { 
-        count_.fetch_add(1, std::memory_order_acq_rel);
+
+    void release(std::uint32_t permits = 1)
+    {
+        count_.fetch_add(permits, std::memory_order_seq_cst);
+
+        if (waiters_.load(std::memory_order_seq_cst) == 0)
+            return;
+
+        if (batch_waiters_.load(std::memory_order_seq_cst) > 0 || permits > static_cast<std::uint32_t>(std::numeric_limits<int>::max()))
+            FutexWake(count_, std::numeric_limits<int>::max());
+        else
+            FutexWake(count_, static_cast<int>(permits));
+    }
+
+    [[nodiscard]] std::uint32_t available() const
+    {
+        return count_.load(std::memory_order_relaxed);
     }
 
 private:
-    std::atomic<int> count_{ 1 };
-};
\ No newline at end of file
+
+    // Registers the calling thread as a (potential) sleeper for its scope.
+
+    struct Waiting
+    {
+        Waiting(Semaphore& semaphore, std::uint32_t permits)
+        : semaphore_{ semaphore }
+        , batch_{ permits > 1 }
+        {
+            if (batch_)
+                semaphore_.batch_waiters_.fetch_add(1, std::memory_order_seq_cst);
+
+            semaphore_.waiters_.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        ~Waiting()
+        {
+            semaphore_.waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+            if (batch_)
+                semaphore_.batch_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        Semaphore& semaphore_;
+        bool batch_{ };
+    };
+
+    // `count` is the caller's latest reading and is refreshed on failure.
+
+    bool TryTake(std::uint32_t& count, std::uint32_t permits)
+    {
+        while (count >= permits)
+        {
+            if (count_.compare_exchange_weak(count, count - permits, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    std::atomic<std::uint32_t> count_{ 1 };
+    std::atomic<std::uint32_t> waiters_{ 0 };
+    std::atomic<std::uint32_t> batch_waiters_{ 0 };
+};
+
+
+TEST_CASE( "Semaphore counts permits.", "[semaphore]" )
+{
+    using namespace std::chrono_literals;
+
+    static_assert(!std::is_convertible_v<int, Semaphore>, "the count constructor is explicit");
+
+    SECTION( "acquire and release move several permits at once." )
+    {
+        Semaphore semaphore{ 3 };
+
+        semaphore.acquire(2);
+        REQUIRE( semaphore.available() == 1 );
+        REQUIRE( semaphore.try_acquire(2) == false );
+        REQUIRE( semaphore.available() == 1 );
+
+        semaphore.release(3);
+        REQUIRE( semaphore.try_acquire(4) == true );
+        REQUIRE( semaphore.available() == 0 );
+        REQUIRE( Semaphore{ }.available() == 1 );
+    }
+
+    SECTION( "At most `count` holders at once." )
+    {
+        Semaphore semaphore{ 2 };
+        std::atomic<int> inside{ 0 };
+        std::atomic<bool> exceeded{ false };
+
+        std::vector<std::jthread> threads{ };
+        for (int t = 0; t < 6; t++)
+        {
+            threads.emplace_back([&]
+            {
+                for (int i = 0; i < 2000; i++)
+                {
+                    semaphore.acquire();
+                    if (++inside > 2)
+                        exceeded = true;
+                    inside--;
+                    semaphore.release();
+                }
+            });
+        }
+
+        threads.clear();
+
+        REQUIRE( exceeded == false );
+        REQUIRE( semaphore.available() == 2 );
+    }
+
+    SECTION( "A batch waiter wakes once enough single releases add up." )
+    {
+        Semaphore semaphore{ 0 };
+        std::atomic<bool> acquired{ false };
+        std::jthread batch{ [&] { semaphore.acquire(3); acquired = true; } };
+
+        semaphore.release();
+        semaphore.release();
+        std::this_thread::sleep_for(20ms);
+        REQUIRE( acquired == false );
+        REQUIRE( semaphore.available() == 2 );
+
+        semaphore.release();
+        batch.join();
+        REQUIRE( acquired == true );
+        REQUIRE( semaphore.available() == 0 );
+    }
+
+    SECTION( "Batch and single waiters all finish when the permits arrive together." )
+    {
+        Semaphore semaphore{ 0 };
+        std::vector<std::jthread> threads{ };
+        threads.emplace_back([&] { semaphore.acquire(3); });
+        threads.emplace_back([&] { semaphore.acquire(2); });
+        for (int t = 0; t < 4; t++)
+            threads.emplace_back([&] { semaphore.acquire(); });
+
+        std::this_thread::sleep_for(20ms);
+        semaphore.release(9);
+        threads.clear();
+
+        REQUIRE( semaphore.available() == 0 );
+    }
+
+    SECTION( "try_acquire_for times out, and returns early once permits arrive." )
+    {
+        Semaphore semaphore{ 1 };
+
+        auto start = std::chrono::steady_clock::now();
+        REQUIRE( semaphore.try_acquire_for(20ms, 2) == false );
+        REQUIRE( std::chrono::steady_clock::now() - start >= 20ms );
+        REQUIRE( semaphore.available() == 1 );
+
+        std::jthread releaser{ [&] { std::this_thread::sleep_for(10ms); semaphore.release(); } };
+
+        start = std::chrono::steady_clock::now();
+        REQUIRE( semaphore.try_acquire_for(5s, 2) == true );
+        REQUIRE( std::chrono::steady_clock::now() - start < 5s );
+        REQUIRE( semaphore.available() == 0 );
+    }
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+#include "mutex.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+// Sequence lock for small, trivially copyable values that are read far more often than they
+// are written, e.g. a best bid/ask or a configuration snapshot. Readers never write shared
+// memory: they copy the value optimistically and retry if a write overlapped the copy, which
+// an odd or changed sequence number reveals. Readers may thus be delayed by a steady stream of
+// writes, but never delay a writer.
+
+// The value is stored as relaxed atomic words rather than as a plain T, so a torn read is a
+// well-defined (and discarded) result rather than a data race. The fences follow Boehm, "Can
+// Seqlocks Get Along With Programming Language Memory Models?".
+
+// `store` must not be called concurrently; see MultiWriterSeqLock for that.
+
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock copies T bytewise");
+
+public:
+
+    SeqLock() : SeqLock(T{ }) { }
+    explicit SeqLock(const T& value)
+    {
+        Write(value);
+    }
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    [[nodiscard]] T load() const
+    {
+        std::array<std::uint64_t, Words> words;
+        while (true)
+        {
+            auto before = sequence_.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                CpuRelax();
+                continue;
+            }
+
+            for (std::size_t i{ 0 }; i < Words; i++)
+                words[i] = words_[i].load(std::memory_order_relaxed);
+
+            // Orders the data loads above before the sequence re-check below.
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (sequence_.load(std::memory_order_relaxed) == before)
+                break;
+        }
+
+        T value;
+        std::memcpy(&value, words.data(), sizeof(T));
+        return value;
+    }
+
+    void store(const T& value)
+    {
+        auto sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+
+        // Orders the odd sequence number before the data stores below.
+        std::atomic_thread_fence(std::memory_order_release);
+
+        Write(value);
+
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+private:
+
+    static constexpr std::size_t Words{ (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t) };
+
+    void Write(const T& value)
+    {
+        std::array<std::uint64_t, Words> words{ };
+        std::memcpy(words.data(), &value, sizeof(T));
+
+        for (std::size_t i{ 0 }; i < Words; i++)
+            words_[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    alignas(64) std::atomic<std::uint64_t> sequence_{ 0 };
+    std::array<std::atomic<std::uint64_t>, Words> words_{ };
+};
+
+// Writers are serialized by a lock that readers never touch, so reads cost the same as with
+// SeqLock. `update` applies a read-modify-write under the writers' lock.
+
+template <typename T, typename Lock = Mutex>
+class MultiWriterSeqLock
+{
+public:
+
+    MultiWriterSeqLock() = default;
+    explicit MultiWriterSeqLock(const T& value) : sequence_lock_{ value } { }
+
+    [[nodiscard]] T load() const
+    {
+        return sequence_lock_.load();
+    }
+
+    void store(const T& value)
+    {
+        std::scoped_lock lock{ writers_ };
+        sequence_lock_.store(value);
+    }
+
+    template <typename Update>
+    void update(Update&& update)
+    {
+        std::scoped_lock lock{ writers_ };
+
+        auto value = sequence_lock_.load();
+        update(value);
+        sequence_lock_.store(value);
+    }
+
+private:
+
+    SeqLock<T> sequence_lock_{ };
+    Lock writers_{ };
+};
+
+
+// Every field of a written value holds the same number, spread over four cache lines so that a
+// torn copy mixes two writes and shows up as unequal fields.
+
+struct SeqLockProbe
+{
+    std::uint64_t fields_[32]{ };
+
+    [[nodiscard]] bool consistent() const
+    {
+        for (auto field : fields_)
+        {
+            if (field != fields_[0])
+                return false;
+        }
+
+        return true;
+    }
+};
+
+TEST_CASE( "SeqLock readers never see a torn value.", "[seqlock]" )
+{
+    constexpr std::uint64_t Writes{ 100'000 };
+
+    SECTION( "Single writer." )
+    {
+        SeqLock<SeqLockProbe> lock{ };
+        std::atomic<bool> done{ false };
+        std::atomic<bool> torn{ false };
+        std::atomic<bool> backwards{ false };
+
+        std::vector<std::jthread> readers{ };
+        for (int t = 0; t < 4; t++)
+        {
+            readers.emplace_back([&]
+            {
+                std::uint64_t last{ 0 };
+                while (!done.load())
+                {
+                    auto value = lock.load();
+                    if (!value.consistent())
+                        torn = true;
+                    if (value.fields_[0] < last)
+                        backwards = true;
+                    last = value.fields_[0];
+                }
+            });
+        }
+
+        for (std::uint64_t i{ 1 }; i <= Writes; i++)
+        {
+            SeqLockProbe value{ };
+            std::fill(std::begin(value.fields_), std::end(value.fields_), i);
+            lock.store(value);
+        }
+
+        done = true;
+        readers.clear();
+
+        REQUIRE( torn == false );
+        REQUIRE( backwards == false );
+        REQUIRE( lock.load().fields_[0] == Writes );
+    }
+
+    SECTION( "Several writers behind a Mutex." )
+    {
+        MultiWriterSeqLock<SeqLockProbe> lock{ };
+        std::atomic<bool> done{ false };
+        std::atomic<bool> torn{ false };
+
+        std::vector<std::jthread> readers{ };
+        for (int t = 0; t < 4; t++)
+        {
+            readers.emplace_back([&]
+            {
+                while (!done.load())
+                {
+                    if (!lock.load().consistent())
+                        torn = true;
+                }
+            });
+        }
+
+        {
+            std::vector<std::jthread> writers{ };
+            for (int t = 0; t < 4; t++)
+            {
+                writers.emplace_back([&lock]
+                {
+                    for (std::uint64_t i{ 0 }; i < Writes / 4; i++)
+                        lock.update([](SeqLockProbe& value) { for (auto& field : value.fields_) field++; });
+                });
+            }
+        }
+
+        done = true;
+        readers.clear();
+
+        REQUIRE( torn == false );
+        REQUIRE( lock.load().consistent() == true );
+        REQUIRE( lock.load().fields_[0] == Writes );
+    }
+}
@@ -0,0 +1,61 @@
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "../latency-histogram.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+
+
+TEST_CASE( "LatencyHistogram buckets by powers of two.", "[latency_histogram]" )
+{
+    SECTION( "Bucket b holds [2^(b-1), 2^b) nanoseconds." )
+    {
+        REQUIRE( LatencyHistogram::BucketOf(0) == 0 );
+        REQUIRE( LatencyHistogram::BucketOf(1) == 1 );
+        REQUIRE( LatencyHistogram::BucketOf(2) == 2 );
+        REQUIRE( LatencyHistogram::BucketOf(3) == 2 );
+        REQUIRE( LatencyHistogram::BucketOf(4) == 3 );
+        REQUIRE( LatencyHistogram::BucketOf(1023) == 10 );
+        REQUIRE( LatencyHistogram::BucketOf(1024) == 11 );
+        REQUIRE( LatencyHistogram::BucketOf(std::numeric_limits<std::uint64_t>::max()) == LatencyHistogram::Buckets - 1 );
+    }
+
+    SECTION( "Percentiles report the upper bound of their bucket." )
+    {
+        LatencyHistogram histogram{ };
+        histogram.counts_[LatencyHistogram::BucketOf(100)] += 90;
+        histogram.counts_[LatencyHistogram::BucketOf(10'000)] += 10;
+
+        REQUIRE( histogram.count() == 100 );
+        REQUIRE( histogram.percentile(0.0) == std::chrono::nanoseconds{ 128 } );
+        REQUIRE( histogram.percentile(0.5) == std::chrono::nanoseconds{ 128 } );
+        REQUIRE( histogram.percentile(0.89) == std::chrono::nanoseconds{ 128 } );
+        REQUIRE( histogram.percentile(0.9) == std::chrono::nanoseconds{ 16'384 } );
+        REQUIRE( histogram.percentile(0.99) == std::chrono::nanoseconds{ 16'384 } );
+    }
+
+    SECTION( "An empty histogram, or one of zero durations, reports zero." )
+    {
+        LatencyHistogram histogram{ };
+        REQUIRE( histogram.percentile(0.99) == std::chrono::nanoseconds{ 0 } );
+
+        histogram.counts_[LatencyHistogram::BucketOf(0)] += 5;
+        REQUIRE( histogram.percentile(0.99) == std::chrono::nanoseconds{ 0 } );
+    }
+
+    SECTION( "Merging adds the counts." )
+    {
+        LatencyHistogram first{ };
+        LatencyHistogram second{ };
+        first.counts_[3] = 2;
+        second.counts_[3] = 1;
+        second.counts_[9] = 4;
+
+        first.merge(second);
+
+        REQUIRE( first.counts_[3] == 3 );
+        REQUIRE( first.counts_[9] == 4 );
+        REQUIRE( first.count() == 7 );
+    }
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../mutex.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+#include <catch2/benchmark/catch_benchmark.hpp> // For benchmarking.
+
+
+// `threads` threads each take the lock `rounds` times and bump a plain counter; a lost update,
+// or a thread finding another inside, means two held the lock at once.
+
+template <typename Lock>
+void CheckMutualExclusion(Lock& lock, unsigned int threads, unsigned int rounds)
+{
+    std::uint64_t counter{ 0 };
+    std::atomic<int> inside{ 0 };
+    std::atomic<bool> overlapped{ false };
+
+    std::vector<std::jthread> workers{ };
+    for (unsigned int t{ 0 }; t < threads; t++)
+    {
+        workers.emplace_back([&]
+        {
+            for (unsigned int i{ 0 }; i < rounds; i++)
+            {
+                std::scoped_lock guard{ lock };
+                if (inside++ != 0)
+                    overlapped = true;
+                counter++;
+                inside--;
+            }
+        });
+    }
+
+    workers.clear();
+
+    REQUIRE( overlapped == false );
+    REQUIRE( counter == std::uint64_t{ threads } * rounds );
+}
+
+// try_lock must fail from another thread while the lock is held, and succeed once it is free.
+
+template <typename Lock>
+void CheckTryLock(Lock& lock)
+{
+    lock.lock();
+    std::jthread{ [&lock] { REQUIRE( lock.try_lock() == false ); } }.join();
+    lock.unlock();
+
+    std::jthread{ [&lock] { REQUIRE( lock.try_lock() == true ); lock.unlock(); } }.join();
+}
+
+TEST_CASE( "Mutex and SpinLock exclude each other's holders.", "[mutex]" )
+{
+    SECTION( "Mutex." )
+    {
+        Mutex mutex{ };
+        CheckMutualExclusion(mutex, 8, 5'000);
+        CheckTryLock(mutex);
+    }
+
+    SECTION( "SpinLock." )
+    {
+        SpinLock spin_lock{ };
+        CheckMutualExclusion(spin_lock, 8, 5'000);
+        CheckTryLock(spin_lock);
+    }
+
+    SECTION( "Parked Mutex waiters all get the lock after a long hold." )
+    {
+        Mutex mutex{ };
+        std::atomic<int> acquired{ 0 };
+
+        mutex.lock();
+        std::vector<std::jthread> waiters{ };
+        for (int t = 0; t < 4; t++)
+            waiters.emplace_back([&] { std::scoped_lock guard{ mutex }; acquired++; });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        REQUIRE( acquired == 0 );
+
+        mutex.unlock();
+        waiters.clear();
+        REQUIRE( acquired == 4 );
+    }
+}
+
+// The queue locks hand off strictly in arrival order, so a preempted waiter stalls everyone
+// behind it; keep the thread count near the core count so the test stays quick everywhere.
+
+TEST_CASE( "TicketLock and McsLock exclude each other's holders.", "[mutex]" )
+{
+    auto threads = std::clamp(std::thread::hardware_concurrency(), 2u, 4u);
+
+    SECTION( "TicketLock." )
+    {
+        TicketLock ticket_lock{ };
+        CheckMutualExclusion(ticket_lock, threads, 500);
+        CheckTryLock(ticket_lock);
+    }
+
+    SECTION( "McsLock." )
+    {
+        McsLock mcs_lock{ };
+        CheckMutualExclusion(mcs_lock, threads, 500);
+        CheckTryLock(mcs_lock);
+    }
+
+    SECTION( "A thread holds several McsLocks and releases them in any order." )
+    {
+        McsLock first{ }, second{ }, third{ };
+
+        first.lock();
+        second.lock();
+        REQUIRE( third.try_lock() == true );
+
+        second.unlock();
+        first.unlock();
+        std::jthread{ [&] { REQUIRE( first.try_lock() == true ); REQUIRE( third.try_lock() == false ); first.unlock(); } }.join();
+        third.unlock();
+
+        // The nodes went back to this thread's free list; contended use after that still works.
+        CheckMutualExclusion(second, threads, 500);
+        CheckMutualExclusion(third, threads, 500);
+    }
+}
+
+// Contention benchmarks: `threads` threads share `Acquisitions` lock/increment/unlock rounds
+// on one counter, so every thread count does the same total work.
+
+template <typename Lock>
+void Contend(Lock& lock, unsigned int threads)
+{
+    constexpr unsigned int Acquisitions{ 1 << 16 };
+
+    std::uint64_t counter{ 0 };
+    std::vector<std::thread> workers{ };
+    for (unsigned int t{ 0 }; t < threads; t++)
+    {
+        workers.emplace_back([&lock, &counter, rounds = Acquisitions / threads]
+        {
+            for (unsigned int i{ 0 }; i < rounds; i++)
+            {
+                std::scoped_lock guard{ lock };
+                counter++;
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    REQUIRE( counter == Acquisitions / threads * threads );
+}
+
+TEST_CASE( "Mutex under contention against std::mutex and SpinLock.", "[mutex][!benchmark]" )
+{
+    auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+    Mutex mutex{ };
+    std::mutex std_mutex{ };
+    SpinLock spin_lock{ };
+
+    BENCHMARK( "Mutex" ) { Contend(mutex, threads); };
+    BENCHMARK( "std::mutex" ) { Contend(std_mutex, threads); };
+    BENCHMARK( "SpinLock" ) { Contend(spin_lock, threads); };
+
+    // Twice as many threads as cores: the spinlock burns the time slices that lock holders need.
+    BENCHMARK( "Mutex, oversubscribed" ) { Contend(mutex, 2 * threads); };
+    BENCHMARK( "std::mutex, oversubscribed" ) { Contend(std_mutex, 2 * threads); };
+    BENCHMARK( "SpinLock, oversubscribed" ) { Contend(spin_lock, 2 * threads); };
+}
+
+// Scalability from 1 to 64 threads. TicketLock and McsLock never sleep, so once threads
+// outnumber cores each handoff can wait for a whole time slice; they stop at the core count.
+
+TEST_CASE( "Lock scalability from 1 to 64 threads.", "[mutex][!benchmark]" )
+{
+    auto cores = std::thread::hardware_concurrency();
+
+    Mutex mutex{ };
+    std::mutex std_mutex{ };
+    TicketLock ticket_lock{ };
+    McsLock mcs_lock{ };
+
+    for (unsigned int threads{ 1 }; threads <= 64; threads *= 2)
+    {
+        auto suffix = ", " + std::to_string(threads) + " threads";
+
+        BENCHMARK( "Mutex" + suffix ) { Contend(mutex, threads); };
+        BENCHMARK( "std::mutex" + suffix ) { Contend(std_mutex, threads); };
+
+        if (threads > cores)
+            continue;
+
+        BENCHMARK( "TicketLock" + suffix ) { Contend(ticket_lock, threads); };
+        BENCHMARK( "McsLock" + suffix ) { Contend(mcs_lock, threads); };
+    }
+}
@@ -0,0 +1,726 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "../thread-pool.h"
+
+#include <catch2/catch_test_macros.hpp> // For testing.
+#include <catch2/benchmark/catch_benchmark.hpp> // For benchmarking.
+
+
+// Counts the calling thread's allocations, for the tests that check a path does not allocate.
+// The whole non-aligned set is replaced so that every form pairs with a matching delete.
+
+static thread_local std::size_t allocations{ 0 };
+
+static void* CountedAllocate(std::size_t size) noexcept
+{
+    allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(std::size_t size)
+{
+    if (auto* pointer = CountedAllocate(size))
+        return pointer;
+
+    throw std::bad_alloc{ };
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+
+
+TEST_CASE( "A pending task can join several when_alls.", "[thread_pool]" )
+{
+    ThreadPool pool{ 2 };
+    std::atomic<bool> release{ false };
+
+    auto a = pool.submit([&release] { while (!release.load()) std::this_thread::yield(); return 1; });
+    auto b = pool.submit([] { return 2; });
+    b.wait();
+
+    auto first = when_all(a, b);
+    auto second = when_all(a);
+
+    REQUIRE( a.ready() == false );
+    REQUIRE( first.ready() == false );
+    REQUIRE( second.ready() == false );
+
+    release.store(true);
+    first.get();
+    second.get();
+
+    REQUIRE( a.ready() == true );
+    REQUIRE( a.get() == 1 );
+}
+
+// A worker waiting on another pool's task must block rather than help: that task completes on
+// the other pool's thread, and a wake-up aimed at this pool could run after it is destroyed.
+
+TEST_CASE( "A worker waits on another pool's task without helping.", "[thread_pool]" )
+{
+    ThreadPool other{ 1 };
+
+    for (int round = 0; round < 200; ++round)
+    {
+        ThreadPool pool{ 1 };
+        auto remote = other.submit([] { std::this_thread::sleep_for(std::chrono::microseconds(50)); return 7; });
+        auto local = pool.submit([&remote] { return remote.get() + 1; });
+
+        REQUIRE( local.get() == 8 );
+    }
+
+    SECTION( "Including through a when_all of both pools." )
+    {
+        ThreadPool pool{ 1 };
+        auto remote = other.submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); return 1; });
+        auto near = pool.submit([] { return 2; });
+        auto local = pool.submit([&] { when_all(remote, near).get(); return remote.get() + near.get(); });
+
+        REQUIRE( local.get() == 3 );
+    }
+}
+
+TEST_CASE( "Idle workers steal from a busy worker's deque.", "[thread_pool]" )
+{
+    ThreadPool pool{ 4 };
+    std::mutex mutex;
+    std::set<std::thread::id> thieves;
+
+    // The owner blocks until every child has run, so each of them must have been stolen.
+    auto owner = pool.submit([&]
+    {
+        std::latch done{ 32 };
+        for (int i = 0; i < 32; i++)
+        {
+            pool.post([&]
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                {
+                    std::scoped_lock lock{ mutex };
+                    thieves.insert(std::this_thread::get_id());
+                }
+                done.count_down();
+            });
+        }
+
+        done.wait();
+        return std::this_thread::get_id();
+    }).get();
+
+    std::uint64_t steals{ 0 };
+    for (const auto& worker : pool.metrics().workers_)
+        steals += worker.steals_;
+
+    REQUIRE( thieves.empty() == false );
+    REQUIRE( thieves.count(owner) == 0 );
+    REQUIRE( steals >= 32 );
+}
+
+TEST_CASE( "Nested fork/join from workers does not starve the pool.", "[thread_pool]" )
+{
+    ThreadPool pool{ 2 };
+
+    std::function<long(int)> fibonacci = [&](int n) -> long
+    {
+        if (n < 2)
+            return n;
+
+        auto left = pool.submit([&fibonacci, n] { return fibonacci(n - 1); });
+        auto right = fibonacci(n - 2);
+        return left.get() + right;
+    };
+
+    REQUIRE( pool.submit([&] { return fibonacci(20); }).get() == 6765 );
+}
+
+// A lost wake-up leaves a task queued with every worker parked. Each round lets the worker
+// park first, then checks that a single post still runs, failing after a deadline rather
+// than hanging.
+
+TEST_CASE( "A post always wakes a parked worker.", "[thread_pool]" )
+{
+    ThreadPool pool{ 1 };
+
+    for (int round = 0; round < 2000; ++round)
+    {
+        if (round % 2 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(round % 100));
+
+        std::atomic<bool> ran{ false };
+        pool.post([&ran] { ran.store(true); });
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!ran.load() && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+
+        REQUIRE( ran.load() == true );
+    }
+}
+
+TEST_CASE( "TaskFunction stores small callables inline.", "[thread_pool]" )
+{
+    int calls = 0;
+
+    SECTION( "A small callable does not allocate." )
+    {
+        auto before = allocations;
+        TaskFunction<64> function{ [&calls] { calls++; } };
+        function();
+
+        REQUIRE( allocations == before );
+        REQUIRE( calls == 1 );
+    }
+
+    SECTION( "A large callable falls back to the heap." )
+    {
+        std::array<char, 128> padding{ };
+        auto before = allocations;
+        TaskFunction<64> function{ [&calls, padding] { calls += 1 + padding[0]; } };
+        function();
+
+        REQUIRE( allocations == before + 1 );
+        REQUIRE( calls == 1 );
+    }
+
+    SECTION( "A callable that may throw when moved falls back to the heap." )
+    {
+        struct Throwing
+        {
+            Throwing(int& calls) : calls_{ calls } { }
+            Throwing(Throwing&& other) noexcept(false) : calls_{ other.calls_ } { }
+            void operator()() { calls_++; }
+            int& calls_;
+        };
+
+        auto before = allocations;
+        TaskFunction<64> function{ Throwing{ calls } };
+        function();
+
+        REQUIRE( allocations == before + 1 );
+        REQUIRE( calls == 1 );
+    }
+
+    SECTION( "Move-only captures survive being moved, inline or not." )
+    {
+        auto value = std::make_unique<int>(5);
+        std::array<char, 128> padding{ };
+
+        TaskFunction<64> small{ [value = std::make_unique<int>(2), &calls] { calls += *value; } };
+        TaskFunction<64> large{ [value = std::move(value), padding, &calls] { calls += *value + padding[0]; } };
+
+        auto moved_small = std::move(small);
+        TaskFunction<64> moved_large{ };
+        moved_large = std::move(large);
+
+        REQUIRE( static_cast<bool>(small) == false );
+        REQUIRE( static_cast<bool>(large) == false );
+
+        moved_small();
+        moved_large();
+        REQUIRE( calls == 7 );
+    }
+}
+
+TEST_CASE( "TaskRing keeps FIFO order across wraparound and growth.", "[thread_pool]" )
+{
+    TaskRing<std::unique_ptr<int>> ring{ 4 };
+    int next_in = 0;
+    int next_out = 0;
+
+    auto push = [&](int count) { for (int i = 0; i < count; i++) ring.push(std::make_unique<int>(next_in++)); };
+    auto pop = [&](int count)
+    {
+        std::unique_ptr<int> item{ };
+        for (int i = 0; i < count; i++)
+        {
+            REQUIRE( ring.try_pop(item) == true );
+            REQUIRE( *item == next_out++ );
+        }
+    };
+
+    push(3);
+    pop(2);
+    push(3); // Wraps around the end of the slots.
+
+    REQUIRE( ring.size() == 4 );
+    REQUIRE( ring.capacity() == 4 );
+    REQUIRE( *ring.front() == 2 );
+
+    push(5); // Grows twice while wrapped.
+
+    REQUIRE( ring.size() == 9 );
+    REQUIRE( ring.capacity() == 16 );
+
+    pop(9);
+
+    std::unique_ptr<int> item{ };
+    REQUIRE( ring.try_pop(item) == false );
+    REQUIRE( ring.empty() == true );
+}
+
+// Posting from a worker uses its preallocated task slots and deque, so once the callable fits
+// inline nothing on the posting thread allocates.
+
+TEST_CASE( "Posting a small task from a worker does not allocate.", "[thread_pool]" )
+{
+    ThreadPool pool{ 2 };
+    constexpr std::size_t Tasks{ 100 };
+
+    auto count_allocations = [&pool](auto make_task)
+    {
+        return pool.submit([&pool, make_task]
+        {
+            std::latch done{ Tasks };
+            auto before = allocations;
+            for (std::size_t i = 0; i < Tasks; i++)
+                pool.post(make_task(done));
+
+            auto allocated = allocations - before;
+            done.wait();
+            return allocated;
+        }).get();
+    };
+
+    std::array<char, 128> padding{ };
+
+    REQUIRE( count_allocations([](std::latch& done) { return [&done] { done.count_down(); }; }) == 0 );
+    REQUIRE( count_allocations([padding](std::latch& done) { return [&done, padding] { done.count_down(); (void)padding; }; }) >= Tasks );
+}
+
+// Compares a callable that fits in TaskInlineSize, which is posted without allocating, with
+// one whose captures force the heap fallback, as every std::function task used to.
+
+TEST_CASE( "Posting inline and heap-allocated tasks.", "[thread_pool][!benchmark]" )
+{
+    constexpr int Tasks{ 10'000 };
+    ThreadPool pool{ 4 };
+
+    BENCHMARK( "post, inline callable" )
+    {
+        std::latch done{ Tasks };
+        for (int i{ 0 }; i < Tasks; i++)
+            pool.post([&done] { done.count_down(); });
+
+        done.wait();
+    };
+
+    BENCHMARK( "post, heap-allocated callable" )
+    {
+        std::latch done{ Tasks };
+        std::array<char, 128> padding{ };
+        for (int i{ 0 }; i < Tasks; i++)
+            pool.post([&done, padding] { done.count_down(); (void)padding; });
+
+        done.wait();
+    };
+
+    BENCHMARK( "submit and get" )
+    {
+        return pool.submit([] { return 1; }).get();
+    };
+}
+
+TEST_CASE( "Timers fire in due order and can be cancelled.", "[thread_pool]" )
+{
+    using namespace std::chrono_literals;
+
+    SECTION( "Delayed tasks run in order of due time, not submission." )
+    {
+        ThreadPool pool{ 1 };
+        std::mutex mutex;
+        std::vector<int> order{ };
+        std::latch done{ 3 };
+
+        auto record = [&](int id) { return [&, id] { { std::scoped_lock lock{ mutex }; order.push_back(id); } done.count_down(); }; };
+
+        auto start = std::chrono::steady_clock::now();
+        pool.submit_after(60ms, record(3));
+        pool.submit_after(20ms, record(1));
+        pool.submit_after(40ms, record(2));
+        done.wait();
+
+        REQUIRE( std::chrono::steady_clock::now() - start >= 60ms );
+        REQUIRE( order == std::vector<int>{ 1, 2, 3 } );
+    }
+
+    SECTION( "A cancelled periodic timer stops ticking." )
+    {
+        ThreadPool pool{ 2 };
+        std::atomic<int> ticks{ 0 };
+
+        auto timer = pool.submit_every(1ms, [&ticks] { ticks++; });
+        while (ticks.load() < 3)
+            std::this_thread::sleep_for(1ms);
+
+        timer.cancel();
+        auto cancelled_at = ticks.load();
+        std::this_thread::sleep_for(30ms);
+
+        REQUIRE( timer.cancelled() == true );
+        REQUIRE( ticks.load() <= cancelled_at + 1 ); // A tick already handed to a worker may still run.
+    }
+
+    SECTION( "A timer cancelled before it is due never runs." )
+    {
+        ThreadPool pool{ 1 };
+        std::atomic<bool> ran{ false };
+
+        pool.submit_after(20ms, [&ran] { ran = true; }).cancel();
+        std::this_thread::sleep_for(40ms);
+
+        REQUIRE( ran == false );
+    }
+
+    SECTION( "A non-positive period is rejected." )
+    {
+        ThreadPool pool{ 1 };
+
+        REQUIRE_THROWS_AS( pool.submit_every(0ms, [] { }), std::invalid_argument );
+        REQUIRE_THROWS_AS( pool.submit_every(-1ms, [] { }), std::invalid_argument );
+    }
+
+    SECTION( "Destroying the pool drops timers that are not due." )
+    {
+        std::atomic<bool> ran{ false };
+        TimerHandle timer{ };
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool{ 1 };
+            timer = pool.submit_after(std::chrono::hours(1), [&ran] { ran = true; });
+            pool.submit_every(1ms, [] { });
+        }
+
+        REQUIRE( std::chrono::steady_clock::now() - start < 1s );
+        REQUIRE( ran == false );
+
+        timer.cancel(); // The handle outlives the pool.
+        REQUIRE( timer.cancelled() == true );
+    }
+}
+
+// Consumes one JSON value from the front of `text`, returning false if it is malformed.
+
+static bool SkipJson(std::string_view& text)
+{
+    auto skip_space = [&text] { while (!text.empty() && (text[0] == ' ' || text[0] == '\n' || text[0] == '\t' || text[0] == '\r')) text.remove_prefix(1); };
+    auto take = [&text, &skip_space](char c) { skip_space(); if (text.empty() || text[0] != c) return false; text.remove_prefix(1); return true; };
+
+    skip_space();
+    if (text.empty())
+        return false;
+
+    if (text[0] == '"')
+    {
+        text.remove_prefix(1);
+        while (!text.empty() && text[0] != '"')
+        {
+            if (static_cast<unsigned char>(text[0]) < 0x20)
+                return false;
+
+            if (text[0] == '\\')
+            {
+                if (text.size() < 2 || std::string_view{ "\"\\/bfnrtu" }.find(text[1]) == std::string_view::npos)
+                    return false;
+
+                if (text[1] == 'u' && (text.size() < 6 || text.substr(2, 4).find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos))
+                    return false;
+
+                text.remove_prefix(text[1] == 'u' ? 6 : 2);
+                continue;
+            }
+
+            text.remove_prefix(1);
+        }
+
+        return take('"');
+    }
+
+    if (text[0] == '{' || text[0] == '[')
+    {
+        auto object = text[0] == '{';
+        auto close = object ? '}' : ']';
+        text.remove_prefix(1);
+        if (take(close))
+            return true;
+
+        do
+        {
+            if (object && !(SkipJson(text) && take(':')))
+                return false;
+
+            if (!SkipJson(text))
+                return false;
+        }
+        while (take(','));
+
+        return take(close);
+    }
+
+    auto length = text.find_first_not_of("0123456789+-.eEtruefalsn");
+    if (length == 0)
+        return false;
+
+    text.remove_prefix(std::min(length, text.size()));
+    return true;
+}
+
+static bool IsJson(std::string_view text)
+{
+    if (!SkipJson(text))
+        return false;
+
+    return text.find_first_not_of(" \n\t\r") == std::string_view::npos;
+}
+
+// Counters are updated after a task completes, so tests poll them briefly.
+
+template <typename Predicate>
+static bool Eventually(Predicate predicate)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!predicate())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        std::this_thread::yield();
+    }
+
+    return true;
+}
+
+TEST_CASE( "Metrics count the pool's work.", "[thread_pool]" )
+{
+    SECTION( "Counters move as tasks run." )
+    {
+        ThreadPool pool{ ThreadPoolOptions{ 2, "metrics" } };
+
+        for (int i = 0; i < 100; i++)
+            pool.submit([] { std::this_thread::sleep_for(std::chrono::microseconds(10)); }).get();
+
+        REQUIRE( Eventually([&pool] { return pool.metrics().tasks_executed() == 100; }) );
+
+        auto metrics = pool.metrics();
+        REQUIRE( metrics.workers_.size() == 2 );
+        REQUIRE( metrics.workers_[0].name_ == "metrics-0" );
+        REQUIRE( metrics.run_time().count() == 100 );
+        REQUIRE( metrics.queue_wait().count() == 100 );
+        REQUIRE( metrics.queue_wait(TaskPriority::Normal).count() == 100 );
+        REQUIRE( metrics.run_time().percentile(0.5) >= std::chrono::microseconds(10) );
+        REQUIRE( metrics.max_injection_depth_ >= 1 );
+        REQUIRE( metrics.workers_[0].busy_ + metrics.workers_[1].busy_ >= std::chrono::milliseconds(1) );
+    }
+
+    SECTION( "Nothing is counted when collection is off." )
+    {
+        ThreadPoolOptions options{ 2, "quiet" };
+        options.collect_metrics_ = false;
+        ThreadPool pool{ options };
+
+        for (int i = 0; i < 10; i++)
+            pool.submit([] { }).get();
+
+        REQUIRE( pool.metrics().tasks_executed() == 0 );
+        REQUIRE( pool.metrics().run_time().count() == 0 );
+    }
+}
+
+TEST_CASE( "write_chrome_trace writes valid JSON.", "[thread_pool]" )
+{
+    ThreadPoolOptions options{ 2, "q\"b\\\n" };
+    options.trace_capacity_ = 16;
+    ThreadPool pool{ options };
+
+    for (int i = 0; i < 40; i++)
+        pool.submit([] { }).get();
+
+    std::string trace{ };
+    auto spans = [&pool, &trace]
+    {
+        std::ostringstream output{ };
+        pool.write_chrome_trace(output);
+        trace = output.str();
+
+        std::size_t count{ 0 };
+        for (auto at = trace.find("\"ph\":\"X\""); at != std::string::npos; at = trace.find("\"ph\":\"X\"", at + 1))
+            count++;
+
+        return count;
+    };
+
+    REQUIRE( Eventually([&spans] { return spans() >= 16; }) );
+    REQUIRE( IsJson(trace) == true );
+    REQUIRE( trace.find(R"("name":"q\"b\\\u000a-0")") != std::string::npos );
+    REQUIRE( IsJson(R"({"a":"unterminated})") == false );
+}
+
+TEST_CASE( "Priority lanes order and bound the work.", "[thread_pool]" )
+{
+    using namespace std::chrono_literals;
+
+    std::mutex mutex;
+    std::vector<int> order{ };
+    auto record = [&](int id) { std::scoped_lock lock{ mutex }; order.push_back(id); };
+
+    SECTION( "High runs ahead of Normal, and Normal ahead of Low." )
+    {
+        ThreadPool pool{ 1 };
+        std::atomic<bool> release{ false };
+        pool.post([&release] { while (!release.load()) std::this_thread::yield(); });
+
+        auto low = pool.submit([&] { record(3); }, TaskPriority::Low);
+        auto normal = pool.submit([&] { record(2); }, TaskPriority::Normal);
+        auto high = pool.submit([&] { record(1); }, TaskPriority::High);
+
+        release = true;
+        wait_all(low, normal, high);
+
+        REQUIRE( order == std::vector<int>{ 1, 2, 3 } );
+    }
+
+    SECTION( "Aging runs a starved Low task ahead of a flood of High ones." )
+    {
+        ThreadPoolOptions options{ 1 };
+        options.aging_ = 5ms;
+        ThreadPool pool{ options };
+
+        std::atomic<bool> release{ false };
+        pool.post([&release] { while (!release.load()) std::this_thread::yield(); });
+
+        auto low = pool.submit([&] { record(-1); }, TaskPriority::Low);
+
+        std::vector<TaskHandle<void>> highs{ };
+        for (int i = 0; i < 200; i++)
+            highs.push_back(pool.submit([&, i] { std::this_thread::sleep_for(1ms); record(i); }, TaskPriority::High));
+
+        release = true;
+        low.get();
+        wait_all(highs);
+
+        auto position = std::find(order.begin(), order.end(), -1) - order.begin();
+        REQUIRE( position < 50 );
+    }
+
+    SECTION( "At most max_low_priority_workers_ workers run Low tasks at once." )
+    {
+        ThreadPoolOptions options{ 4 };
+        options.max_low_priority_workers_ = 1;
+        ThreadPool pool{ options };
+
+        std::atomic<int> running{ 0 };
+        std::atomic<int> most{ 0 };
+        std::vector<TaskHandle<void>> lows{ };
+        for (int i = 0; i < 16; i++)
+        {
+            lows.push_back(pool.submit([&]
+            {
+                auto now = ++running;
+                for (auto seen = most.load(); now > seen && !most.compare_exchange_weak(seen, now); )
+                    ;
+
+                std::this_thread::sleep_for(1ms);
+                running--;
+            }, TaskPriority::Low));
+        }
+
+        // Normal work still gets the other workers while the Low lane is capped.
+        REQUIRE( pool.submit([] { return 1; }).get() == 1 );
+
+        wait_all(lows);
+        REQUIRE( most == 1 );
+    }
+}
+
+#ifdef __linux__
+
+static std::vector<int> CurrentAffinity()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+
+    std::vector<int> cpus{ };
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+TEST_CASE( "Workers pin themselves to their CPUs.", "[thread_pool]" )
+{
+    auto allowed = CurrentAffinity();
+    REQUIRE( allowed.empty() == false );
+    auto cpu = allowed.front();
+
+    SECTION( "A pinned worker runs only on its CPU." )
+    {
+        ThreadPool pool{ ThreadPoolOptions::pinned({ cpu }, "pinned") };
+
+        REQUIRE( pool.submit([] { return CurrentAffinity(); }).get() == std::vector<int>{ cpu } );
+    }
+
+    SECTION( "Invalid CPUs are skipped, and a worker left with none stays unpinned." )
+    {
+        ThreadPoolOptions options{ 2, "invalid" };
+        options.affinity_ = { { cpu, -1, CPU_SETSIZE + 5 }, { -1, CPU_SETSIZE } };
+        ThreadPool pool{ options };
+
+        std::mutex mutex;
+        std::set<std::vector<int>> seen{ };
+        std::vector<TaskHandle<void>> tasks{ };
+        for (int i = 0; i < 64; i++)
+        {
+            tasks.push_back(pool.submit([&]
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                std::scoped_lock lock{ mutex };
+                seen.insert(CurrentAffinity());
+            }));
+        }
+
+        wait_all(tasks);
+
+        for (const auto& cpus : seen)
+            REQUIRE( (cpus == std::vector<int>{ cpu } || cpus == allowed) );
+    }
+}
+
+#endif
@@ -1,86 +1,1853 @@
+#pragma once
+
 #include <thread>
 #include <vector>
 #include <optional>
 #include <chrono>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
 #include <queue>
+#include <array>
+#include <bit>
+#include <ostream>
+#include <cstdint>
+#include <type_traits>
 #include <functional>
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <coroutine>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <cstdlib>
 
-class ThreadPool
+#include "latency-histogram.h"
+
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// Chase-Lev work-stealing deque (following Le, Pop, Cohen and Zappa Nardelli, "Correct and
+// Efficient Work-Stealing for Weak Memory Models"). The owning thread pushes and pops at the
+// bottom (LIFO, hot in cache), other threads steal from the top (FIFO, oldest and usually
+// largest work first). Only the owner may call `push` and `pop`.
+
+// Items are copied in and out of atomic slots, so T must be trivially copyable; the pool
+// stores pointers. Outgrown buffers are kept alive until the deque is destroyed, as a thief
+// may still be reading from one. A deque constructed with capacity 0 allocates its buffer on
+// the owner's first `reserve` or `push`, so the memory is first touched by the owning thread.
+
+template <typename T>
+class WorkStealingDeque
 {
+    static_assert(std::is_trivially_copyable_v<T>);
+
 public:
 
-    ThreadPool(std::size_t count = std::thread::hardware_concurrency())
+    explicit WorkStealingDeque(std::size_t capacity = 256)
     {
-        try
+        reserve(capacity);
+    }
+
+    // Owner only, and only before the first push.
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity == 0 || buffer_.load(std::memory_order_relaxed) != nullptr)
+            return;
+
+        buffers_.push_back(std::make_unique<Buffer>(capacity));
+        buffer_.store(buffers_.back().get(), std::memory_order_release);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    void push(T item)
+    {
+        auto bottom = bottom_.load(std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_acquire);
+        auto* buffer = buffer_.load(std::memory_order_relaxed);
+
+        if (buffer == nullptr)
         {
-            for (unsigned int i = 0; i < count; i++)
-                threads_.emplace_back([this] { Work(); });
+            reserve(DefaultCapacity);
+            buffer = buffer_.load(std::memory_order_relaxed);
         }
-        catch (...)
+
+        if (bottom - top > static_cast<std::int64_t>(buffer->capacity_) - 1)
+            buffer = Grow(buffer, bottom, top);
+
+        buffer->put(bottom, item);
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    std::optional<T> pop()
+    {
+        auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        auto* buffer = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = top_.load(std::memory_order_relaxed);
+
+        if (top > bottom)
         {
-            done_.store(true, std::memory_order_relaxed);
-            throw;
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return std::nullopt;
         }
-    }
 
-    ThreadPool(const ThreadPool&) = delete;
-    ThreadPool& operator=(const ThreadPool&) = delete;
+        auto item = buffer->get(bottom);
+        if (top == bottom)
+        {
+            // Last item, race the thieves for it.
+            bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            if (!won)
+                return std::nullopt;
+        }
 
-    ~ThreadPool()
+        return item;
+    }
+
+    std::optional<T> steal()
     {
-        done_.store(true, std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto bottom = bottom_.load(std::memory_order_acquire);
 
-        for (auto& thread : threads_)
-            thread.join();
+        if (top >= bottom)
+            return std::nullopt;
+
+        auto* buffer = buffer_.load(std::memory_order_acquire);
+        auto item = buffer->get(top);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return std::nullopt;
+
+        return item;
     }
 
-    template <typename Work>
-    void submit(Work work)
+    // Approximate when called concurrently with `push`, `pop` or `steal`.
+
+    [[nodiscard]] std::size_t size() const
+    {
+        auto bottom = bottom_.load(std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+    }
+
+    [[nodiscard]] bool empty() const
     {
-        std::scoped_lock lock{ mutex_ };
-        queue_.push([=] { work(); });
+        return size() == 0;
     }
 
 private:
 
-    void Work()
+    static constexpr std::size_t DefaultCapacity{ 256 };
+
+    struct Buffer
     {
-        while (!done_.load(std::memory_order_relaxed))
+        explicit Buffer(std::size_t capacity)
+        : capacity_{ capacity }
+        , items_{ std::make_unique<std::atomic<T>[]>(capacity) }
         {
-            std::optional<std::function<void()>> task{ std::nullopt };
-            {
-                std::scoped_lock lock{  mutex_ };
-                if (!queue_.empty())
-                {
-                    task = queue_.front();
-                    queue_.pop();
-                }
-            }
+        }
+
+        T get(std::int64_t index) const
+        {
+            return items_[static_cast<std::size_t>(index) % capacity_].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t index, T item)
+        {
+            items_[static_cast<std::size_t>(index) % capacity_].store(item, std::memory_order_relaxed);
+        }
+
+        std::size_t capacity_{ };
+        std::unique_ptr<std::atomic<T>[]> items_{ nullptr };
+    };
+
+    Buffer* Grow(Buffer* buffer, std::int64_t bottom, std::int64_t top)
+    {
+        buffers_.push_back(std::make_unique<Buffer>(2 * buffer->capacity_));
+        auto* grown = buffers_.back().get();
+
+        for (auto i = top; i < bottom; i++)
+            grown->put(i, buffer->get(i));
+
+        buffer_.store(grown, std::memory_order_release);
+        return grown;
+    }
 
-            if (!task.has_value())
+    alignas(64) std::atomic<std::int64_t> top_{ 0 };
+    alignas(64) std::atomic<std::int64_t> bottom_{ 0 };
+    std::atomic<Buffer*> buffer_{ nullptr };
+    std::vector<std::unique_ptr<Buffer>> buffers_{ };
+};
+
+
+// Move-only, type-erased `void()` callable. Callables that fit in `InlineSize` bytes (and can
+// be moved without throwing) are stored in place, larger ones fall back to the heap. Unlike
+// std::function it accepts move-only captures and never copies.
+
+template <std::size_t InlineSize = 64>
+class TaskFunction
+{
+    static_assert(InlineSize >= sizeof(void*));
+
+public:
+
+    TaskFunction() noexcept = default;
+
+    template <typename Function, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, TaskFunction>>>
+    TaskFunction(Function&& function)
+    {
+        using Callable = std::decay_t<Function>;
+
+        if constexpr (IsInline<Callable>)
+            new (&storage_) Callable(std::forward<Function>(function));
+        else
+            new (&storage_) Callable*(new Callable(std::forward<Function>(function)));
+
+        operations_ = &OperationsFor<Callable>;
+    }
+
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+
+    TaskFunction(TaskFunction&& other) noexcept
+    {
+        StealFrom(other);
+    }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            StealFrom(other);
+        }
+
+        return *this;
+    }
+
+    ~TaskFunction()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        operations_->invoke(&storage_);
+    }
+
+    void reset()
+    {
+        if (operations_ == nullptr)
+            return;
+
+        operations_->destroy(&storage_);
+        operations_ = nullptr;
+    }
+
+    explicit operator bool() const noexcept { return operations_ != nullptr; }
+
+private:
+
+    struct Operations
+    {
+        void (*invoke)(void* storage);
+        void (*relocate)(void* to, void* from);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Callable>
+    static constexpr bool IsInline = sizeof(Callable) <= InlineSize
+        && alignof(Callable) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<Callable>;
+
+    template <typename Callable>
+    static Callable& Get(void* storage)
+    {
+        if constexpr (IsInline<Callable>)
+            return *std::launder(reinterpret_cast<Callable*>(storage));
+        else
+            return **std::launder(reinterpret_cast<Callable**>(storage));
+    }
+
+    template <typename Callable>
+    static constexpr Operations OperationsFor
+    {
+        [](void* storage) { std::invoke(Get<Callable>(storage)); },
+        [](void* to, void* from)
+        {
+            if constexpr (IsInline<Callable>)
             {
-                std::this_thread::yield();
-                //std::this_thread::sleep_for(std::chrono::milliseconds{500})
+                new (to) Callable(std::move(Get<Callable>(from)));
+                Get<Callable>(from).~Callable();
             }
             else
             {
-                try
-                {
-                    task.value()();
-                }
-                catch (...)
-                {
-                    // Log
-                }
+                new (to) Callable*(&Get<Callable>(from));
             }
+        },
+        [](void* storage)
+        {
+            if constexpr (IsInline<Callable>)
+                Get<Callable>(storage).~Callable();
+            else
+                delete &Get<Callable>(storage);
+        },
+    };
+
+    void StealFrom(TaskFunction& other) noexcept
+    {
+        if (other.operations_ == nullptr)
+            return;
+
+        other.operations_->relocate(&storage_, &other.storage_);
+        operations_ = std::exchange(other.operations_, nullptr);
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[InlineSize];
+    const Operations* operations_{ nullptr };
+};
+
+
+// FIFO ring buffer over preallocated slots. Unlike CircularBuffer it never overwrites: when
+// full it doubles, so after warm-up pushing and popping only move elements. Not synchronized.
+
+template <typename T>
+class TaskRing
+{
+public:
+
+    explicit TaskRing(std::size_t capacity = 1024)
+    : capacity_{ std::max<std::size_t>(capacity, 1) }
+    , slots_{ std::make_unique<T[]>(capacity_) }
+    {
+    }
+
+    void push(T&& item)
+    {
+        if (size_ == capacity_)
+            Grow();
+
+        slots_[(read_idx_ + size_) % capacity_] = std::move(item);
+        size_++;
+    }
+
+    bool try_pop(T& item)
+    {
+        if (size_ == 0)
+            return false;
+
+        item = std::move(slots_[read_idx_]);
+        read_idx_ = (read_idx_ + 1) % capacity_;
+        size_--;
+
+        return true;
+    }
+
+    [[nodiscard]] const T& front() const
+    {
+        return slots_[read_idx_];
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] std::size_t capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+
+    void Grow()
+    {
+        auto slots = std::make_unique<T[]>(2 * capacity_);
+        for (std::size_t i{ 0 }; i < size_; i++)
+            slots[i] = std::move(slots_[(read_idx_ + i) % capacity_]);
+
+        slots_ = std::move(slots);
+        capacity_ *= 2;
+        read_idx_ = 0;
+    }
+
+    std::size_t capacity_{ };
+    std::unique_ptr<T[]> slots_{ nullptr };
+    std::size_t read_idx_{ 0 };
+    std::size_t size_{ 0 };
+};
+
+
+class ThreadPool;
+
+// Shared state behind a TaskHandle. Completion is a single atomic: it holds the list of
+// continuations registered by `when_all` (or by a waiting worker), or the Completed sentinel.
+// Waiters block on it with C++20 atomic wait, so a finished task costs one exchange and no lock.
+
+// A state may name the pool whose workers complete it. Only those workers help while waiting
+// (see ThreadPool::HelpUntilReady); any other thread blocks.
+
+class TaskStateBase
+{
+public:
+
+    using Continuation = std::function<void()>;
+
+    virtual ~TaskStateBase() = default;
+
+    [[nodiscard]] bool ready() const
+    {
+        return continuations_.load(std::memory_order_acquire) == Completed();
+    }
+
+    void wait() const;
+
+    // Any number of continuations may be registered; they run in registration order on the
+    // thread that completes the task, or immediately if the task has already completed.
+    // Registering one does not change the task's result, hence const.
+
+    void then(Continuation continuation) const
+    {
+        auto* node = new ContinuationNode{ std::move(continuation) };
+        auto* head = continuations_.load(std::memory_order_acquire);
+        while (head != Completed())
+        {
+            node->next_ = head;
+            if (continuations_.compare_exchange_weak(head, node, std::memory_order_acq_rel, std::memory_order_acquire))
+                return;
         }
+
+        node->continuation_();
+        delete node;
     }
 
-    std::atomic<bool> done_{ false };
-    mutable std::mutex mutex_{ };
-    std::queue<std::function<void()>> queue_;
-    std::vector<std::thread> threads_{ };
+    [[nodiscard]] const std::exception_ptr& exception() const
+    {
+        return exception_;
+    }
+
+    [[nodiscard]] const ThreadPool* pool() const
+    {
+        return pool_;
+    }
+
+    // Before the state is shared with other threads.
+
+    void set_pool(const ThreadPool* pool)
+    {
+        pool_ = pool;
+    }
+
+protected:
+
+    void complete()
+    {
+        auto* head = continuations_.exchange(Completed(), std::memory_order_acq_rel);
+        continuations_.notify_all();
+
+        // The list was built by pushing at the head, so reverse it to run in registration order.
+        ContinuationNode* ordered{ nullptr };
+        while (head != nullptr)
+            ordered = std::exchange(head, head->next_)->Prepend(ordered);
+
+        while (ordered != nullptr)
+        {
+            auto* node = std::exchange(ordered, ordered->next_);
+            node->continuation_();
+            delete node;
+        }
+    }
 
-};
\ No newline at end of file
+    void block() const
+    {
+        auto* head = continuations_.load(std::memory_order_acquire);
+        while (head != Completed())
+        {
+            continuations_.wait(head, std::memory_order_acquire);
+            head = continuations_.load(std::memory_order_acquire);
+        }
+    }
+
+    std::exception_ptr exception_{ nullptr };
+
+private:
+
+    struct ContinuationNode
+    {
+        ContinuationNode* Prepend(ContinuationNode* next)
+        {
+            next_ = next;
+            return this;
+        }
+
+        Continuation continuation_{ };
+        ContinuationNode* next_{ nullptr };
+    };
+
+    static ContinuationNode* Completed()
+    {
+        static ContinuationNode sentinel{ };
+        return &sentinel;
+    }
+
+    mutable std::atomic<ContinuationNode*> continuations_{ nullptr };
+    const ThreadPool* pool_{ nullptr };
+};
+
+template <typename R>
+class TaskState : public TaskStateBase
+{
+public:
+
+    R take()
+    {
+        if (exception_)
+            std::rethrow_exception(exception_);
+
+        return std::move(*value_);
+    }
+
+protected:
+
+    std::optional<R> value_{ std::nullopt };
+};
+
+template <>
+class TaskState<void> : public TaskStateBase
+{
+public:
+
+    void take()
+    {
+        if (exception_)
+            std::rethrow_exception(exception_);
+    }
+};
+
+// Owns the callable until it has run, so move-only callables are supported and the callable
+// is moved exactly once, into this single allocation.
+
+template <typename R, typename Work>
+class TaskStateImpl : public TaskState<R>
+{
+public:
+
+    explicit TaskStateImpl(Work&& work) : work_{ std::move(work) } { }
+    explicit TaskStateImpl(const Work& work) : work_{ work } { }
+
+    void run()
+    {
+        try
+        {
+            if constexpr (std::is_void_v<R>)
+                std::invoke(*work_);
+            else
+                this->value_.emplace(std::invoke(*work_));
+        }
+        catch (...)
+        {
+            this->exception_ = std::current_exception();
+        }
+
+        work_.reset();
+        this->complete();
+    }
+
+private:
+
+    std::optional<Work> work_{ std::nullopt };
+};
+
+// Move-only handle to the result of ThreadPool::submit. `get` waits for the task and returns
+// its result, or rethrows the exception it exited with. When called from a worker of the pool
+// running the task, waiting runs other queued tasks instead of blocking, so nested fork/join
+// cannot starve the pool.
+
+template <typename R>
+class TaskHandle
+{
+public:
+
+    TaskHandle() = default;
+    explicit TaskHandle(std::shared_ptr<TaskState<R>> state) : state_{ std::move(state) } { }
+
+    TaskHandle(const TaskHandle&) = delete;
+    TaskHandle& operator=(const TaskHandle&) = delete;
+    TaskHandle(TaskHandle&&) noexcept = default;
+    TaskHandle& operator=(TaskHandle&&) noexcept = default;
+
+    [[nodiscard]] bool valid() const
+    {
+        return state_ != nullptr;
+    }
+
+    [[nodiscard]] bool ready() const
+    {
+        return state_->ready();
+    }
+
+    void wait() const
+    {
+        state_->wait();
+    }
+
+    R get()
+    {
+        state_->wait();
+        auto state = std::move(state_);
+        return state->take();
+    }
+
+private:
+
+    std::shared_ptr<TaskState<R>> state_{ nullptr };
+
+    template <typename... Rs>
+    friend TaskHandle<void> when_all(TaskHandle<Rs>&... handles);
+
+    template <typename T>
+    friend TaskHandle<void> when_all(std::vector<TaskHandle<T>>& handles);
+};
+
+// Completes once every input has completed. Its `get` rethrows the first exception raised by
+// an input; the inputs themselves stay valid for retrieving individual results, and a handle
+// may take part in any number of `when_all`s. Waiting helps only if all inputs come from
+// one pool, since the last of them to finish completes the join on its thread.
+
+class JoinState : public TaskState<void>
+{
+public:
+
+    explicit JoinState(std::size_t count) : remaining_{ count } { }
+
+    static void attach(const std::shared_ptr<JoinState>& join, const TaskStateBase& input)
+    {
+        if (join->attached_++ == 0)
+            join->set_pool(input.pool());
+        else if (join->pool() != input.pool())
+            join->set_pool(nullptr);
+
+        input.then([join, &input]
+        {
+            if (input.exception() && !join->failed_.exchange(true, std::memory_order_relaxed))
+                join->exception_ = input.exception();
+
+            if (join->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                join->complete();
+        });
+    }
+
+    static TaskHandle<void> complete_if_empty(std::shared_ptr<JoinState> join, std::size_t count)
+    {
+        if (count == 0)
+            join->complete();
+
+        return TaskHandle<void>{ std::move(join) };
+    }
+
+private:
+
+    std::atomic<std::size_t> remaining_{ };
+    std::atomic<bool> failed_{ false };
+    std::size_t attached_{ 0 };
+};
+
+// Takes TaskHandles only, so that it does not compete with the coroutine when_all over Tasks.
+
+template <typename... Rs>
+TaskHandle<void> when_all(TaskHandle<Rs>&... handles)
+{
+    auto join = std::make_shared<JoinState>(sizeof...(handles));
+    (JoinState::attach(join, *handles.state_), ...);
+    return JoinState::complete_if_empty(std::move(join), sizeof...(handles));
+}
+
+template <typename T>
+TaskHandle<void> when_all(std::vector<TaskHandle<T>>& handles)
+{
+    auto join = std::make_shared<JoinState>(handles.size());
+    for (auto& handle : handles)
+        JoinState::attach(join, *handle.state_);
+
+    return JoinState::complete_if_empty(std::move(join), handles.size());
+}
+
+template <typename... Handles>
+void wait_all(const Handles&... handles)
+{
+    (handles.wait(), ...);
+}
+
+template <typename T>
+void wait_all(const std::vector<TaskHandle<T>>& handles)
+{
+    for (const auto& handle : handles)
+        handle.wait();
+}
+
+
+// State shared between a TimerHandle and the pool's timer queue. The callable is kept for the
+// lifetime of the timer, so a periodic timer reuses it on every tick. If a tick comes due while
+// the previous one is still running, it is skipped rather than run concurrently.
+
+class TimerState
+{
+public:
+
+    virtual ~TimerState() = default;
+
+    virtual void fire() = 0;
+
+    void cancel()
+    {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    std::atomic<bool> cancelled_{ false };
+};
+
+template <typename Work>
+class TimerStateImpl : public TimerState
+{
+public:
+
+    explicit TimerStateImpl(Work&& work) : work_{ std::move(work) } { }
+    explicit TimerStateImpl(const Work& work) : work_{ work } { }
+
+    void fire() override
+    {
+        if (cancelled() || running_.exchange(true, std::memory_order_acquire))
+            return;
+
+        try
+        {
+            std::invoke(work_);
+        }
+        catch (...)
+        {
+            // Log
+        }
+
+        running_.store(false, std::memory_order_release);
+    }
+
+private:
+
+    Work work_;
+    std::atomic<bool> running_{ false };
+};
+
+class TimerHandle
+{
+public:
+
+    TimerHandle() = default;
+    explicit TimerHandle(std::shared_ptr<TimerState> state) : state_{ std::move(state) } { }
+
+    // A tick already handed to a worker may still run once.
+
+    void cancel()
+    {
+        if (state_ != nullptr)
+            state_->cancel();
+    }
+
+    [[nodiscard]] bool valid() const
+    {
+        return state_ != nullptr;
+    }
+
+    [[nodiscard]] bool cancelled() const
+    {
+        return state_ != nullptr && state_->cancelled();
+    }
+
+private:
+
+    std::shared_ptr<TimerState> state_{ nullptr };
+};
+
+
+// Lanes are drained in this order, see ThreadPool::RunNext. Work submitted without a priority
+// from inside a task inherits that task's priority, so a Low task cannot fan out Normal work
+// that escapes the low-priority bound; from outside the pool it defaults to Normal.
+
+enum class TaskPriority
+{
+    High,
+    Normal,
+    Low,
+};
+
+inline constexpr std::size_t TaskPriorityCount{ 3 };
+
+struct WorkerMetrics
+{
+    std::string name_{ };
+    std::uint64_t tasks_executed_{ };
+    std::uint64_t steals_{ };
+    std::chrono::nanoseconds busy_{ };
+    std::chrono::nanoseconds idle_{ };
+    std::chrono::nanoseconds parked_{ };
+    std::size_t max_queue_depth_{ };
+    LatencyHistogram queue_wait_{ };
+    LatencyHistogram run_time_{ };
+    std::array<LatencyHistogram, TaskPriorityCount> queue_wait_by_priority_{ };
+};
+
+struct ThreadPoolMetrics
+{
+    [[nodiscard]] std::uint64_t tasks_executed() const
+    {
+        std::uint64_t tasks{ 0 };
+        for (const auto& worker : workers_)
+            tasks += worker.tasks_executed_;
+
+        return tasks;
+    }
+
+    [[nodiscard]] LatencyHistogram queue_wait() const
+    {
+        LatencyHistogram histogram{ };
+        for (const auto& worker : workers_)
+            histogram.merge(worker.queue_wait_);
+
+        return histogram;
+    }
+
+    [[nodiscard]] LatencyHistogram queue_wait(TaskPriority priority) const
+    {
+        LatencyHistogram histogram{ };
+        for (const auto& worker : workers_)
+            histogram.merge(worker.queue_wait_by_priority_[static_cast<std::size_t>(priority)]);
+
+        return histogram;
+    }
+
+    [[nodiscard]] LatencyHistogram run_time() const
+    {
+        LatencyHistogram histogram{ };
+        for (const auto& worker : workers_)
+            histogram.merge(worker.run_time_);
+
+        return histogram;
+    }
+
+    std::vector<WorkerMetrics> workers_{ };
+    std::size_t max_injection_depth_{ };
+};
+
+
+// Placement of a pool's workers. Worker i runs on `affinity_[i % affinity_.size()]`, a set of
+// CPU ids; an empty list leaves the scheduler free to move workers around. Threads are named
+// "<name_>-<i>" (with name_ truncated to fit the 15 characters Linux allows) so they show up in top and perf.
+// Affinity and names are applied on Linux only and on a best-effort basis.
+
+// With `collect_metrics_` each worker keeps its own counters and histograms (see
+// ThreadPool::metrics); with a non-zero `trace_capacity_` it also keeps its most recent task
+// spans for ThreadPool::write_chrome_trace.
+
+// Strict priority lets a steady stream of high-priority work starve the lower lanes. With a
+// non-zero `aging_`, a lower lane's oldest task that has waited longer than that is run ahead
+// of the higher lanes. A non-zero `max_low_priority_workers_` caps how many workers may run
+// low-priority tasks at once, keeping the rest free for latency-critical work.
+
+struct ThreadPoolOptions
+{
+    using CpuSet = std::vector<int>;
+
+    std::size_t thread_count_{ std::thread::hardware_concurrency() };
+    std::string name_{ "pool" };
+    std::vector<CpuSet> affinity_{ };
+    bool collect_metrics_{ true };
+    std::size_t trace_capacity_{ 0 };
+    std::chrono::steady_clock::duration aging_{ std::chrono::steady_clock::duration::zero() };
+    std::size_t max_low_priority_workers_{ 0 };
+
+    // One worker pinned to each of `cpus`, e.g. pinned({ 2, 3, 4, 5, 6, 7 }, "match") to give
+    // the matching shard pool cores 2-7 to itself (keep other threads off them with isolcpus
+    // or the affinity of the rest of the process).
+
+    static ThreadPoolOptions pinned(const std::vector<int>& cpus, std::string name)
+    {
+        ThreadPoolOptions options{ cpus.size(), std::move(name) };
+        for (auto cpu : cpus)
+            options.affinity_.push_back({ cpu });
+
+        return options;
+    }
+};
+
+// Work submitted from outside the pool goes through a shared injection queue, one per priority
+// lane. Normal-priority work submitted from inside a task goes to the submitting worker's own
+// deque, where it is popped LIFO by its owner and stolen FIFO by idle workers; high and low
+// priority work always goes through its lane. A worker that finds no work anywhere spins briefly,
+// then parks on a condition variable; submitters only take the parking lock when a worker is
+// actually asleep, and wake exactly one.
+
+// Each worker pins and names itself before allocating its deque and task slots, so with the
+// kernel's first-touch policy they land on the worker's NUMA node. Thieves try workers on
+// their own node before crossing to another socket.
+
+// Delayed and periodic tasks are kept in a min-heap ordered by due time and served by a single
+// timer thread, started on first use, that posts each due task to the workers. Scheduling is
+// O(log n); cancelled timers are dropped lazily when they come due.
+
+// Metrics are only ever written by the worker they describe, as relaxed loads and stores to
+// that worker's own cache lines; readers take a snapshot that may be slightly torn across
+// counters. Enabled, they cost two clock reads per task and one per enqueue.
+
+class ThreadPool
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    ThreadPool(std::size_t count = std::thread::hardware_concurrency())
+    : ThreadPool(ThreadPoolOptions{ count })
+    {
+    }
+
+    explicit ThreadPool(const ThreadPoolOptions& options)
+    : name_{ options.name_ }
+    , collect_metrics_{ options.collect_metrics_ }
+    , trace_capacity_{ options.trace_capacity_ }
+    , aging_{ options.aging_ }
+    , max_low_priority_workers_{ options.max_low_priority_workers_ }
+    {
+        auto count = std::max<std::size_t>(options.thread_count_, 1);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            auto& worker = *workers_.emplace_back(std::make_unique<Worker>(this, i));
+            worker.name_ = ThreadName(options.name_, std::to_string(i));
+            worker.trace_.resize(trace_capacity_); // before the worker starts; write_chrome_trace reads it
+            if (!options.affinity_.empty())
+                worker.cpus_ = options.affinity_[i % options.affinity_.size()];
+            if (!worker.cpus_.empty())
+                worker.node_ = NodeOfCpu(worker.cpus_.front());
+        }
+
+        for (auto& worker : workers_)
+            worker->victims_ = VictimsOf(*worker);
+
+        try
+        {
+            for (std::size_t i = 0; i < count; i++)
+                threads_.emplace_back([this, i] { Work(*workers_[i]); });
+        }
+        catch (...)
+        {
+            Stop();
+            throw;
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Tasks already submitted are run to completion before the workers exit. Timers that have
+    // not come due yet are dropped.
+
+    ~ThreadPool()
+    {
+        StopTimers();
+        Stop();
+    }
+
+    template <typename Work>
+    auto submit(Work&& work, std::optional<TaskPriority> priority = std::nullopt)
+    {
+        using Result = std::invoke_result_t<std::decay_t<Work>&>;
+
+        auto state = std::make_shared<TaskStateImpl<Result, std::decay_t<Work>>>(std::forward<Work>(work));
+        state->set_pool(this);
+        Enqueue([state] { state->run(); }, PriorityOf(priority));
+
+        return TaskHandle<Result>{ std::move(state) };
+    }
+
+    // Fire-and-forget. A callable of up to TaskInlineSize bytes is stored inline in a
+    // preallocated slot, so posting and running it does not allocate. There is no handle to
+    // report to, so an exception escaping `work` is dropped.
+
+    template <typename Work>
+    void post(Work&& work, std::optional<TaskPriority> priority = std::nullopt)
+    {
+        Enqueue(Task{ std::forward<Work>(work) }, PriorityOf(priority));
+    }
+
+    // `co_await pool.schedule()` suspends the calling coroutine and resumes it on a worker,
+    // see coroutine-task.h.
+
+    struct ScheduleAwaiter
+    {
+        [[nodiscard]] bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            pool_.post([awaiting] { awaiting.resume(); }, priority_);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+        ThreadPool& pool_;
+        std::optional<TaskPriority> priority_{ std::nullopt };
+    };
+
+    [[nodiscard]] ScheduleAwaiter schedule(std::optional<TaskPriority> priority = std::nullopt)
+    {
+        return ScheduleAwaiter{ *this, priority };
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return workers_.size();
+    }
+
+    template <typename Work>
+    TimerHandle submit_after(Clock::duration delay, Work&& work)
+    {
+        auto state = std::make_shared<TimerStateImpl<std::decay_t<Work>>>(std::forward<Work>(work));
+        Schedule(state, Clock::now() + delay, Clock::duration::zero());
+        return TimerHandle{ std::move(state) };
+    }
+
+    // Fixed rate: ticks are due every `period` from now. Ticks missed while the pool was
+    // saturated are not made up for. The period must be positive: zero would mean a one-shot
+    // timer and a negative one would keep the next tick in the past.
+
+    template <typename Work>
+    TimerHandle submit_every(Clock::duration period, Work&& work)
+    {
+        if (period <= Clock::duration::zero())
+            throw std::invalid_argument("submit_every needs a positive period");
+
+        auto state = std::make_shared<TimerStateImpl<std::decay_t<Work>>>(std::forward<Work>(work));
+        Schedule(state, Clock::now() + period, period);
+        return TimerHandle{ std::move(state) };
+    }
+
+    [[nodiscard]] ThreadPoolMetrics metrics() const
+    {
+        ThreadPoolMetrics metrics{ };
+        for (const auto& lane : lanes_)
+        {
+            std::scoped_lock lock{ lane.mutex_ };
+            metrics.max_injection_depth_ = std::max(metrics.max_injection_depth_, lane.max_depth_);
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started_);
+        for (const auto& worker : workers_)
+        {
+            const auto& counters = worker->counters_;
+
+            WorkerMetrics snapshot{ };
+            snapshot.name_ = worker->name_;
+            snapshot.tasks_executed_ = counters.tasks_.load(std::memory_order_relaxed);
+            snapshot.steals_ = counters.steals_.load(std::memory_order_relaxed);
+            snapshot.busy_ = std::chrono::nanoseconds{ counters.busy_.load(std::memory_order_relaxed) };
+            snapshot.parked_ = std::chrono::nanoseconds{ counters.parked_.load(std::memory_order_relaxed) };
+            snapshot.idle_ = std::max(std::chrono::nanoseconds{ 0 }, elapsed - snapshot.busy_ - snapshot.parked_);
+            snapshot.max_queue_depth_ = counters.max_queue_depth_.load(std::memory_order_relaxed);
+
+            for (std::size_t i{ 0 }; i < LatencyHistogram::Buckets; i++)
+            {
+                snapshot.queue_wait_.counts_[i] = counters.queue_wait_[i].load(std::memory_order_relaxed);
+                snapshot.run_time_.counts_[i] = counters.run_time_[i].load(std::memory_order_relaxed);
+
+                for (std::size_t lane{ 0 }; lane < TaskPriorityCount; lane++)
+                    snapshot.queue_wait_by_priority_[lane].counts_[i] = counters.queue_wait_by_priority_[lane][i].load(std::memory_order_relaxed);
+            }
+
+            metrics.workers_.push_back(std::move(snapshot));
+        }
+
+        return metrics;
+    }
+
+    // Writes the retained task spans in Chrome's trace event format, one track per worker;
+    // open the file in chrome://tracing or ui.perfetto.dev.
+
+    void write_chrome_trace(std::ostream& output) const
+    {
+        output << "{\"traceEvents\":[";
+
+        bool first{ true };
+        auto separator = [&output, &first] { output << (first ? "\n" : ",\n"); first = false; };
+
+        for (const auto& worker : workers_)
+        {
+            separator();
+            output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << worker->index_
+                   << ",\"args\":{\"name\":\"" << JsonEscaped(worker->name_) << "\"}}";
+
+            std::scoped_lock lock{ worker->trace_mutex_ };
+            for (const auto& span : worker->trace_)
+            {
+                if (span.duration_ns_ < 0)
+                    continue;
+
+                separator();
+                output << "{\"name\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":" << worker->index_
+                       << ",\"ts\":" << static_cast<double>(span.start_ns_) / 1000.0
+                       << ",\"dur\":" << static_cast<double>(span.duration_ns_) / 1000.0 << "}";
+            }
+        }
+
+        output << "\n]}\n";
+    }
+
+    // Index of the calling thread within this pool, if it is one of its workers.
+
+    [[nodiscard]] std::optional<std::size_t> worker_index() const
+    {
+        auto* worker = current_worker_;
+        if (worker == nullptr || worker->pool_ != this)
+            return std::nullopt;
+
+        return worker->index_;
+    }
+
+private:
+
+    static constexpr std::size_t TaskInlineSize{ 64 };
+    static constexpr std::size_t MaxThreadName{ 15 };
+    static constexpr std::size_t DequeCapacity{ 256 };
+    static constexpr std::size_t SlotCount{ 256 };
+    static constexpr std::size_t SlotProbes{ 8 };
+    static constexpr unsigned int SpinCount{ 64 };
+
+    using Task = TaskFunction<TaskInlineSize>;
+
+    // Tasks pushed onto a worker's deque live in that worker's slot arena; the deque only holds
+    // pointers. Only the owner claims slots, whichever thread runs the task frees it. When the
+    // probed slots are all busy the task spills to a heap-allocated slot.
+
+    struct TaskSlot
+    {
+        Task task_{ };
+        Clock::time_point enqueued_at_{ };
+        std::atomic<bool> in_use_{ false };
+        bool pooled_{ true };
+    };
+
+    struct QueuedTask
+    {
+        Task task_{ };
+        Clock::time_point enqueued_at_{ };
+    };
+
+    // Written only by the owning worker, hence plain load/store instead of read-modify-write.
+
+    struct alignas(64) WorkerCounters
+    {
+        static void Add(std::atomic<std::uint64_t>& counter, std::uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        std::atomic<std::uint64_t> tasks_{ 0 };
+        std::atomic<std::uint64_t> steals_{ 0 };
+        std::atomic<std::uint64_t> busy_{ 0 };
+        std::atomic<std::uint64_t> parked_{ 0 };
+        std::atomic<std::size_t> max_queue_depth_{ 0 };
+        std::array<std::atomic<std::uint64_t>, LatencyHistogram::Buckets> queue_wait_{ };
+        std::array<std::atomic<std::uint64_t>, LatencyHistogram::Buckets> run_time_{ };
+        std::array<std::array<std::atomic<std::uint64_t>, LatencyHistogram::Buckets>, TaskPriorityCount> queue_wait_by_priority_{ };
+    };
+
+    // `oldest_` mirrors the enqueue time of the task at the head of the queue, so that aging
+    // can be checked without taking the lane's lock.
+
+    struct alignas(64) Lane
+    {
+        mutable std::mutex mutex_{ };
+        TaskRing<QueuedTask> queue_{ };
+        std::atomic<std::size_t> queued_{ 0 };
+        std::atomic<Clock::rep> oldest_{ 0 };
+        std::size_t max_depth_{ 0 };
+    };
+
+    // Ring of the most recent spans; a negative duration marks an unused entry.
+
+    struct TraceSpan
+    {
+        std::int64_t start_ns_{ 0 };
+        std::int64_t duration_ns_{ -1 };
+    };
+
+    struct Worker
+    {
+        Worker(ThreadPool* pool, std::size_t index) : pool_{ pool }, index_{ index } { }
+
+        ThreadPool* pool_{ nullptr };
+        std::size_t index_{ };
+        std::string name_{ };
+        ThreadPoolOptions::CpuSet cpus_{ };
+        int node_{ -1 };
+        std::vector<std::size_t> victims_{ };
+
+        // Allocated by the worker thread itself, see Work.
+        WorkStealingDeque<TaskSlot*> deque_{ 0 };
+        std::unique_ptr<TaskSlot[]> slots_{ nullptr };
+        std::size_t next_slot_{ 0 };
+
+        // Priority of the task running now, inherited by work it submits; see Run.
+        TaskPriority priority_{ TaskPriority::Normal };
+
+        WorkerCounters counters_{ };
+        mutable std::mutex trace_mutex_{ };
+        std::vector<TraceSpan> trace_{ };
+        std::size_t trace_next_{ 0 };
+    };
+
+    static inline thread_local Worker* current_worker_{ nullptr };
+
+    [[nodiscard]] TaskPriority PriorityOf(std::optional<TaskPriority> priority) const
+    {
+        if (priority)
+            return *priority;
+
+        auto* worker = current_worker_;
+        return worker != nullptr && worker->pool_ == this ? worker->priority_ : TaskPriority::Normal;
+    }
+
+    void Enqueue(Task task, TaskPriority priority = TaskPriority::Normal)
+    {
+        auto enqueued_at = collect_metrics_ || aging_ != Clock::duration::zero() ? Clock::now() : Clock::time_point{ };
+
+        auto* worker = current_worker_;
+        if (priority == TaskPriority::Normal && worker != nullptr && worker->pool_ == this)
+        {
+            auto* slot = AcquireSlot(*worker);
+            slot->task_ = std::move(task);
+            slot->enqueued_at_ = enqueued_at;
+            worker->deque_.push(slot);
+
+            auto& max_depth = worker->counters_.max_queue_depth_;
+            auto depth = worker->deque_.size();
+            if (depth > max_depth.load(std::memory_order_relaxed))
+                max_depth.store(depth, std::memory_order_relaxed);
+        }
+        else
+        {
+            auto& lane = lanes_[static_cast<std::size_t>(priority)];
+
+            std::scoped_lock lock{ lane.mutex_ };
+            if (lane.queue_.empty())
+                lane.oldest_.store(enqueued_at.time_since_epoch().count(), std::memory_order_relaxed);
+
+            lane.queue_.push({ std::move(task), enqueued_at });
+            lane.queued_.fetch_add(1, std::memory_order_relaxed);
+            lane.max_depth_ = std::max(lane.max_depth_, lane.queue_.size());
+        }
+
+        NotifyOne();
+    }
+
+    static TaskSlot* AcquireSlot(Worker& worker)
+    {
+        for (std::size_t i{ 0 }; i < SlotProbes; i++)
+        {
+            auto index = (worker.next_slot_ + i) % SlotCount;
+            auto& slot = worker.slots_[index];
+            if (!slot.in_use_.load(std::memory_order_acquire))
+            {
+                slot.in_use_.store(true, std::memory_order_relaxed);
+                worker.next_slot_ = index + 1;
+                return &slot;
+            }
+        }
+
+        auto* slot = new TaskSlot{ };
+        slot->pooled_ = false;
+        return slot;
+    }
+
+    static void ReleaseSlot(TaskSlot* slot)
+    {
+        slot->task_.reset();
+
+        if (slot->pooled_)
+            slot->in_use_.store(false, std::memory_order_release);
+        else
+            delete slot;
+    }
+
+    // Pool names are user-supplied, so quotes, backslashes and control characters are escaped
+    // to keep the trace valid JSON.
+
+    static std::string JsonEscaped(std::string_view text)
+    {
+        std::string escaped{ };
+        escaped.reserve(text.size());
+
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                constexpr char Hex[]{ "0123456789abcdef" };
+                escaped += "\\u00";
+                escaped += Hex[(c >> 4) & 0xf];
+                escaped += Hex[c & 0xf];
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+
+        return escaped;
+    }
+
+    // Called by TaskStateBase::wait on a worker of the pool that completes `state`. Runs other
+    // tasks while there are any; when there are none it parks like an idle worker, woken by new
+    // work or by the task completing, rather than spinning until a slow task is done. The wake-up
+    // runs on one of this pool's workers, which the destructor joins, so it cannot outlive the pool.
+
+    static void HelpUntilReady(const TaskStateBase& state)
+    {
+        auto* worker = current_worker_;
+        auto* pool = worker->pool_;
+        bool woken_on_completion{ false };
+
+        while (!state.ready())
+        {
+            if (pool->RunNext(*worker))
+                continue;
+
+            if (!woken_on_completion)
+            {
+                state.then([pool]
+                {
+                    { std::scoped_lock lock{ pool->park_mutex_ }; }
+                    pool->park_ready_.notify_all();
+                });
+                woken_on_completion = true;
+            }
+
+            pool->ParkUntilReady(*worker, state);
+        }
+    }
+
+    void Work(Worker& worker)
+    {
+        PinCurrentThread(worker.cpus_);
+        NameCurrentThread(worker.name_);
+
+        worker.deque_.reserve(DequeCapacity);
+        worker.slots_ = std::make_unique<TaskSlot[]>(SlotCount);
+
+        current_worker_ = &worker;
+
+        while (true)
+        {
+            if (RunNext(worker))
+                continue;
+
+            bool found{ false };
+            for (unsigned int i{ 0 }; i < SpinCount && !found; i++)
+            {
+                std::this_thread::yield();
+                found = RunNext(worker);
+            }
+
+            if (!found && !Park(worker))
+                break;
+        }
+
+        current_worker_ = nullptr;
+    }
+
+    // High lane, own deque, normal lane, the other workers' deques, then the low lane. Aged
+    // tasks of the lower lanes go first.
+
+    bool RunNext(Worker& worker)
+    {
+        if (aging_ != Clock::duration::zero() && RunAged(worker))
+            return true;
+
+        if (RunFromLane(worker, TaskPriority::High))
+            return true;
+
+        if (auto slot = worker.deque_.pop())
+        {
+            Run(worker, *slot);
+            return true;
+        }
+
+        if (RunFromLane(worker, TaskPriority::Normal))
+            return true;
+
+        for (auto index : worker.victims_)
+        {
+            if (auto slot = workers_[index]->deque_.steal())
+            {
+                if (collect_metrics_)
+                    WorkerCounters::Add(worker.counters_.steals_, 1);
+
+                Run(worker, *slot);
+                return true;
+            }
+        }
+
+        return RunFromLane(worker, TaskPriority::Low);
+    }
+
+    bool RunAged(Worker& worker)
+    {
+        if (lanes_[static_cast<std::size_t>(TaskPriority::Normal)].queued_.load(std::memory_order_relaxed) == 0
+            && lanes_[static_cast<std::size_t>(TaskPriority::Low)].queued_.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        auto deadline = Clock::now() - aging_;
+        return RunFromLane(worker, TaskPriority::Low, deadline) || RunFromLane(worker, TaskPriority::Normal, deadline);
+    }
+
+    // Runs the task at the head of the lane, provided it was enqueued no later than
+    // `enqueued_before` and, for the low lane, a low-priority slot is free.
+
+    bool RunFromLane(Worker& worker, TaskPriority priority, Clock::time_point enqueued_before = Clock::time_point::max())
+    {
+        auto& lane = lanes_[static_cast<std::size_t>(priority)];
+        if (lane.queued_.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        if (lane.oldest_.load(std::memory_order_relaxed) > enqueued_before.time_since_epoch().count())
+            return false;
+
+        auto bounded = priority == TaskPriority::Low && max_low_priority_workers_ != 0;
+        if (bounded && low_priority_running_.fetch_add(1, std::memory_order_acquire) >= max_low_priority_workers_)
+        {
+            low_priority_running_.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+
+        QueuedTask queued{ };
+        bool found{ false };
+        {
+            std::scoped_lock lock{ lane.mutex_ };
+            if (!lane.queue_.empty() && lane.queue_.front().enqueued_at_ <= enqueued_before)
+            {
+                found = lane.queue_.try_pop(queued);
+                lane.queued_.fetch_sub(1, std::memory_order_relaxed);
+                if (!lane.queue_.empty())
+                    lane.oldest_.store(lane.queue_.front().enqueued_at_.time_since_epoch().count(), std::memory_order_relaxed);
+            }
+        }
+
+        if (found)
+            Run(worker, queued.task_, queued.enqueued_at_, priority);
+
+        if (bounded)
+            low_priority_running_.fetch_sub(1, std::memory_order_release);
+
+        return found;
+    }
+
+    // Submitted tasks capture their own exceptions (see TaskStateImpl::run), posted ones are dropped.
+
+    void Run(Worker& worker, Task& task, Clock::time_point enqueued_at, TaskPriority priority = TaskPriority::Normal)
+    {
+        auto started = collect_metrics_ ? Clock::now() : Clock::time_point{ };
+
+        // Restored afterwards, as a task waiting in TaskHandle::get runs others in between.
+        auto outer = std::exchange(worker.priority_, priority);
+
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            // Log
+        }
+
+        worker.priority_ = outer;
+
+        if (collect_metrics_)
+            Record(worker, enqueued_at, started, Clock::now(), priority);
+    }
+
+    void Run(Worker& worker, TaskSlot* slot)
+    {
+        Run(worker, slot->task_, slot->enqueued_at_);
+        ReleaseSlot(slot);
+    }
+
+    void Record(Worker& worker, Clock::time_point enqueued_at, Clock::time_point started, Clock::time_point finished, TaskPriority priority)
+    {
+        auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(started - enqueued_at).count();
+        auto ran = std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count();
+
+        auto& counters = worker.counters_;
+        WorkerCounters::Add(counters.tasks_, 1);
+        WorkerCounters::Add(counters.busy_, static_cast<std::uint64_t>(ran));
+        auto wait_bucket = LatencyHistogram::BucketOf(static_cast<std::uint64_t>(waited));
+        WorkerCounters::Add(counters.queue_wait_[wait_bucket], 1);
+        WorkerCounters::Add(counters.queue_wait_by_priority_[static_cast<std::size_t>(priority)][wait_bucket], 1);
+        WorkerCounters::Add(counters.run_time_[LatencyHistogram::BucketOf(static_cast<std::uint64_t>(ran))], 1);
+
+        if (worker.trace_.empty())
+            return;
+
+        std::scoped_lock lock{ worker.trace_mutex_ };
+        worker.trace_[worker.trace_next_] = { std::chrono::duration_cast<std::chrono::nanoseconds>(started - started_).count(), ran };
+        worker.trace_next_ = (worker.trace_next_ + 1) % worker.trace_.size();
+    }
+
+    [[nodiscard]] bool HasWork() const
+    {
+        for (std::size_t i{ 0 }; i < TaskPriorityCount; i++)
+        {
+            if (lanes_[i].queued_.load(std::memory_order_relaxed) == 0)
+                continue;
+
+            // Workers finishing a low-priority task poll again, so a saturated low lane need not wake anyone.
+            if (static_cast<TaskPriority>(i) == TaskPriority::Low && max_low_priority_workers_ != 0
+                && low_priority_running_.load(std::memory_order_relaxed) >= max_low_priority_workers_)
+                continue;
+
+            return true;
+        }
+
+        for (const auto& worker : workers_)
+        {
+            if (!worker->deque_.empty())
+                return true;
+        }
+
+        return false;
+    }
+
+    // Returns false once the pool is stopping and no work is left. The sleeper count is
+    // published before the final check for work, and submitters publish their work before
+    // reading the sleeper count, so at least one side sees the other.
+
+    bool Park(Worker& worker)
+    {
+        std::unique_lock lock{ park_mutex_ };
+
+        sleepers_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (HasWork())
+        {
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        if (done_)
+        {
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto parked = collect_metrics_ ? Clock::now() : Clock::time_point{ };
+
+        park_ready_.wait(lock, [this] { return wakeups_ > 0 || done_; });
+
+        if (collect_metrics_)
+            WorkerCounters::Add(worker.counters_.parked_, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - parked).count()));
+
+        if (wakeups_ > 0)
+            wakeups_--;
+
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // As Park, but also returns once `state` is ready. A wakeup meant for new work that
+    // arrives together with completion is passed on, since this worker returns to its task.
+
+    void ParkUntilReady(Worker& worker, const TaskStateBase& state)
+    {
+        bool pass_on{ false };
+        {
+            std::unique_lock lock{ park_mutex_ };
+
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // Unlike Park, stopping does not end the wait: the task still completes elsewhere.
+            if (!HasWork())
+            {
+                auto parked = collect_metrics_ ? Clock::now() : Clock::time_point{ };
+
+                park_ready_.wait(lock, [this, &state] { return wakeups_ > 0 || state.ready(); });
+
+                if (collect_metrics_)
+                    WorkerCounters::Add(worker.counters_.parked_, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - parked).count()));
+
+                if (wakeups_ > 0)
+                {
+                    wakeups_--;
+                    pass_on = state.ready();
+                }
+            }
+
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        if (pass_on)
+            NotifyOne();
+    }
+
+    void NotifyOne()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_seq_cst) == 0)
+            return;
+
+        {
+            std::scoped_lock lock{ park_mutex_ };
+            if (wakeups_ >= sleepers_.load(std::memory_order_relaxed))
+                return;
+
+            wakeups_++;
+        }
+
+        park_ready_.notify_one();
+    }
+
+    // Steal order: the other workers on the same NUMA node, then the rest, each group in
+    // round-robin order starting after `worker` so that thieves spread over victims.
+
+    std::vector<std::size_t> VictimsOf(const Worker& worker) const
+    {
+        std::vector<std::size_t> local, remote;
+        for (std::size_t i{ 1 }; i < workers_.size(); i++)
+        {
+            auto index = (worker.index_ + i) % workers_.size();
+            if (workers_[index]->node_ == worker.node_)
+                local.push_back(index);
+            else
+                remote.push_back(index);
+        }
+
+        local.insert(local.end(), remote.begin(), remote.end());
+        return local;
+    }
+
+    static int NodeOfCpu(int cpu)
+    {
+#ifdef __linux__
+        std::error_code error;
+        auto path = std::filesystem::path{ "/sys/devices/system/cpu" } / ("cpu" + std::to_string(cpu));
+        for (const auto& entry : std::filesystem::directory_iterator{ path, error })
+        {
+            auto name = entry.path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0)
+                return std::atoi(name.c_str() + 4);
+        }
+#endif
+        return -1;
+    }
+
+    static void PinCurrentThread(const ThreadPoolOptions::CpuSet& cpus)
+    {
+#ifdef __linux__
+        if (cpus.empty())
+            return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+    // Truncates `name` rather than `suffix`, so that threads of one pool stay distinguishable.
+
+    static std::string ThreadName(const std::string& name, const std::string& suffix)
+    {
+        auto length = MaxThreadName - std::min(MaxThreadName, suffix.size() + 1);
+        return name.substr(0, length) + "-" + suffix;
+    }
+
+    static void NameCurrentThread(const std::string& name)
+    {
+#ifdef __linux__
+        pthread_setname_np(pthread_self(), name.substr(0, MaxThreadName).c_str());
+#endif
+    }
+
+    struct TimerEntry
+    {
+        Clock::time_point due_{ };
+        std::uint64_t sequence_{ };
+        Clock::duration period_{ };
+        std::shared_ptr<TimerState> state_{ nullptr };
+
+        bool operator>(const TimerEntry& other) const
+        {
+            return due_ != other.due_ ? due_ > other.due_ : sequence_ > other.sequence_;
+        }
+    };
+
+    void Schedule(std::shared_ptr<TimerState> state, Clock::time_point due, Clock::duration period)
+    {
+        {
+            std::scoped_lock lock{ timer_mutex_ };
+
+            if (!timer_thread_.joinable())
+                timer_thread_ = std::thread{ [this] { RunTimers(); } };
+
+            timers_.push({ due, timer_sequence_++, period, std::move(state) });
+        }
+
+        timer_ready_.notify_one();
+    }
+
+    void RunTimers()
+    {
+        NameCurrentThread(ThreadName(name_, "timer"));
+
+        std::unique_lock lock{ timer_mutex_ };
+        while (!timers_stopping_)
+        {
+            if (timers_.empty())
+            {
+                timer_ready_.wait(lock);
+                continue;
+            }
+
+            auto due = timers_.top().due_;
+            auto now = Clock::now();
+            if (now < due)
+            {
+                timer_ready_.wait_until(lock, due);
+                continue;
+            }
+
+            auto entry = timers_.top();
+            timers_.pop();
+
+            if (entry.state_->cancelled())
+                continue;
+
+            if (entry.period_ != Clock::duration::zero())
+            {
+                auto next = entry;
+                next.due_ += entry.period_;
+                if (next.due_ <= now)
+                    next.due_ += ((now - next.due_) / entry.period_ + 1) * entry.period_;
+
+                next.sequence_ = timer_sequence_++;
+                timers_.push(std::move(next));
+            }
+
+            lock.unlock();
+            post([state = std::move(entry.state_)] { state->fire(); });
+            lock.lock();
+        }
+    }
+
+    void StopTimers()
+    {
+        {
+            std::scoped_lock lock{ timer_mutex_ };
+            timers_stopping_ = true;
+        }
+
+        timer_ready_.notify_one();
+
+        if (timer_thread_.joinable())
+            timer_thread_.join();
+    }
+
+    void Stop()
+    {
+        {
+            std::scoped_lock lock{ park_mutex_ };
+            done_ = true;
+        }
+
+        park_ready_.notify_all();
+
+        for (auto& thread : threads_)
+            thread.join();
+
+        threads_.clear();
+    }
+
+    std::string name_{ };
+    bool collect_metrics_{ };
+    std::size_t trace_capacity_{ };
+    Clock::time_point started_{ Clock::now() };
+
+    Clock::duration aging_{ };
+    std::size_t max_low_priority_workers_{ };
+
+    std::array<Lane, TaskPriorityCount> lanes_{ };
+    std::atomic<std::size_t> low_priority_running_{ 0 };
+
+    std::mutex park_mutex_{ };
+    std::condition_variable park_ready_{ };
+    std::atomic<std::size_t> sleepers_{ 0 };
+    std::size_t wakeups_{ 0 };
+    bool done_{ false };
+
+    std::vector<std::unique_ptr<Worker>> workers_{ };
+    std::vector<std::thread> threads_{ };
+
+    std::mutex timer_mutex_{ };
+    std::condition_variable timer_ready_{ };
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> timers_{ };
+    std::uint64_t timer_sequence_{ 0 };
+    bool timers_stopping_{ false };
+    std::thread timer_thread_{ };
+
+    friend class TaskStateBase;
+};
+
+inline void TaskStateBase::wait() const
+{
+    auto* worker = ThreadPool::current_worker_;
+    if (worker != nullptr && pool_ != nullptr && worker->pool_ == pool_)
+        ThreadPool::HelpUntilReady(*this);
+    else
+        block();
+}
@@ -1,12 +1,25 @@
 #include <utility>
 #include <iostream>
+#include <atomic>
+#include <new>
 #include <mutex>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include <catch2/catch_session.hpp> // For testing.
+#include <catch2/catch_test_macros.hpp> // For testing.
+#include <catch2/benchmark/catch_benchmark.hpp> // For benchmarking.
 
 /*
 Constructor
 - SharedPointer(std::nullptr_t)
 - SharedPointer(T*)
+- SharedPointer<T, NonAtomicRefCount> / SharedPointer<T, BiasedRefCount>
 
 reset(T*)
 reset()
@@ -14,17 +27,492 @@ get_count()
 get()
 operator->()
 operator*()
+
+make_shared<T>(args...)
+
+AtomicSharedPointer<T>: load(), store(), exchange(), compare_exchange_strong()
+
+IntrusivePointer<T> for T deriving from IntrusiveRefCount<T, Release>
+make_intrusive<T>(args...) / make_pooled<T>(args...)
+
+WeakPointer(const SharedPointer<T>&)
+lock()
+expired()
+use_count()
+reset()
 */
 
-struct ControlBlock
+// Reference counting policies, chosen per SharedPointer type with the second template
+// parameter. Each one provides the strong and weak counts the control block derives from:
+// - AtomicRefCount (default): safe to share and release across threads.
+// - NonAtomicRefCount: plain counters, for objects whose pointers never leave one thread.
+// - BiasedRefCount: plain counter for the thread that created the object, atomic for others.
+// Ownership semantics are the same under every policy, only the cost of a copy differs.
+
+// The counts are atomic: taking a reference only needs the count to stay above zero, which the
+// reference we copy from guarantees, so the increment can be relaxed. The decrement is
+// acq_rel so that every owner's writes to the object happen before the last owner destroys it.
+
+// The block outlives the object while WeakPointers remain: the last strong reference destroys
+// the object, the last weak reference frees the block. The strong references together hold
+// one weak reference, so the block is freed exactly once, by whichever side finishes last.
+struct AtomicRefCount
+{
+    std::atomic<size_t> _count{ 1 };
+    std::atomic<size_t> _weak_count{ 1 };
+
+    void add_strong() noexcept
+    {
+        _count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // For WeakPointer::lock: the object may already be gone, so only increment a count that
+    // is still nonzero. Checking and then incrementing would let the last owner destroy the
+    // object in between.
+    bool try_add_strong() noexcept
+    {
+        auto count = _count.load(std::memory_order_relaxed);
+        while (count != 0)
+        {
+            if (_count.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    // Returns true if the object must be destroyed
+    bool release_strong() noexcept
+    {
+        return _count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    size_t strong_count() const noexcept
+    {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+    void add_weak() noexcept
+    {
+        _weak_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns true if the block must be freed
+    bool release_weak() noexcept
+    {
+        return _weak_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+// Every SharedPointer and WeakPointer to the object must be copied and destroyed on the same
+// thread; the object itself may still be handed to other threads by other means.
+struct NonAtomicRefCount
+{
+    size_t _count{ 1 };
+    size_t _weak_count{ 1 };
+
+    void add_strong() noexcept { _count++; }
+    bool try_add_strong() noexcept { return _count != 0 && ++_count; }
+    bool release_strong() noexcept { return --_count == 0; }
+    size_t strong_count() const noexcept { return _count; }
+
+    void add_weak() noexcept { _weak_count++; }
+    bool release_weak() noexcept { return --_weak_count == 0; }
+};
+
+class BiasedRefCount;
+
+// The per-thread state BiasedRefCount blocks refer to as their owner: a queue of blocks whose
+// shared count went negative, which only the owner can settle. It is reference counted by the
+// thread and by its blocks, since blocks may outlive the thread.
+class BiasedOwner
+{
+public:
+
+    static BiasedOwner* current()
+    {
+        // A plain pointer stays readable while other thread_locals are destroyed
+        thread_local BiasedOwner* owner{ new BiasedOwner{ } };
+        thread_local ThreadExit exit{ owner };
+        return owner;
+    }
+
+    void retain() noexcept
+    {
+        _references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() noexcept
+    {
+        if (_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    // Read without the lock by the owner thread only
+    bool exited() const noexcept
+    {
+        return _exited;
+    }
+
+    void drain_if_queued()
+    {
+        if (_has_queued.load(std::memory_order_relaxed))
+            _drain();
+    }
+
+    inline void enqueue(BiasedRefCount* block);
+
+private:
+
+    struct ThreadExit
+    {
+        BiasedOwner* _owner{ nullptr };
+
+        ~ThreadExit()
+        {
+            _owner->_exit();
+        }
+    };
+
+    inline void _drain();
+    inline void _exit();
+
+    std::atomic<size_t> _references{ 1 };
+    std::atomic<bool> _has_queued{ false };
+
+    std::mutex _mutex;
+    std::vector<BiasedRefCount*> _queued;
+    bool _exited{ false };
+};
+
+// Biased reference counting (Choi, Shull and Torrellas, PACT 2018). The thread that creates
+// the object counts its references in `_biased` without atomics; other threads count theirs
+// in `_shared`. A reference taken on the owner thread but released elsewhere drives
+// `_shared` negative: the block is then queued for the owner, who merges `_biased` into
+// `_shared` on its next release (or when it exits), after which everyone uses `_shared` and
+// the object is destroyed when it reaches zero. The owner also merges when `_biased` drops
+// to zero. Until a merge the object cannot be destroyed, so no thread needs to know the total.
+
+// `_shared` holds the count shifted left by two, with the Merged and Queued flags below it,
+// so that a release can test and set them in the same atomic operation.
+class BiasedRefCount
+{
+public:
+
+    BiasedRefCount()
+    : _owner{ BiasedOwner::current() }
+    {
+        _owner->retain();
+    }
+
+    ~BiasedRefCount()
+    {
+        _owner->release();
+    }
+
+    BiasedRefCount(const BiasedRefCount&) = delete;
+    BiasedRefCount& operator=(const BiasedRefCount&) = delete;
+
+    void add_strong() noexcept
+    {
+        if (_is_biased())
+            _biased++;
+        else
+            _shared.fetch_add(Unit, std::memory_order_relaxed);
+    }
+
+    bool try_add_strong() noexcept
+    {
+        // Unmerged objects are never destroyed, so the owner can always take one more
+        if (_is_biased())
+        {
+            _biased++;
+            return true;
+        }
+
+        auto shared = _shared.load(std::memory_order_relaxed);
+        while ((shared & Merged) == 0 || _count_of(shared) != 0)
+        {
+            if (_shared.compare_exchange_weak(shared, shared + Unit, std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    bool release_strong()
+    {
+        if (_is_owner())
+            _owner->drain_if_queued(); // may merge this block
+
+        if (!_is_biased())
+            return _release_shared();
+
+        if (--_biased != 0)
+            return false;
+
+        _merged = true;
+        auto shared = _shared.fetch_add(Merged, std::memory_order_acq_rel);
+        return _count_of(shared) == 0 && (shared & Queued) == 0;
+    }
+
+    // Other threads cannot read `_biased`, so until a merge they only see their own references
+    size_t strong_count() const noexcept
+    {
+        auto count = _count_of(_shared.load(std::memory_order_relaxed));
+        if (_is_biased())
+            count += _biased;
+
+        return count > 0 ? static_cast<size_t>(count) : 0;
+    }
+
+    void add_weak() noexcept
+    {
+        _weak_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool release_weak() noexcept
+    {
+        return _weak_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+protected:
+
+    // Destroys the object and drops the strong references' weak reference, for a merge that
+    // finds no references left
+    virtual void release_object() = 0;
+
+private:
+
+    friend class BiasedOwner;
+
+    static constexpr int64_t Merged{ 1 };
+    static constexpr int64_t Queued{ 2 };
+    static constexpr int64_t Unit{ 4 };
+
+    static int64_t _count_of(int64_t shared) noexcept
+    {
+        return shared >> 2;
+    }
+
+    bool _is_owner() const noexcept
+    {
+        return _owner == BiasedOwner::current() && !_owner->exited();
+    }
+
+    // The owner's references go to `_biased` until it has been merged
+    bool _is_biased() const noexcept
+    {
+        return _is_owner() && !_merged;
+    }
+
+    bool _release_shared()
+    {
+        auto shared = _shared.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto released = shared - Unit;
+            bool queue = (shared & (Merged | Queued)) == 0 && _count_of(released) < 0;
+            if (queue)
+                released |= Queued;
+
+            if (!_shared.compare_exchange_weak(shared, released, std::memory_order_acq_rel, std::memory_order_relaxed))
+                continue;
+
+            if (queue)
+                _owner->enqueue(this);
+
+            return (shared & Merged) != 0 && (shared & Queued) == 0 && _count_of(released) == 0;
+        }
+    }
+
+    // Called for a queued block by its owner, or by the thread that queued it if the owner
+    // has exited
+    void _merge_queued()
+    {
+        bool dead{ false };
+        if (!_merged)
+        {
+            _merged = true;
+            auto shared = _shared.fetch_add(_biased * Unit + Merged - Queued, std::memory_order_acq_rel);
+            dead = _count_of(shared) + _biased == 0;
+        }
+        else
+        {
+            auto shared = _shared.fetch_sub(Queued, std::memory_order_acq_rel);
+            dead = _count_of(shared) == 0;
+        }
+
+        if (dead)
+            release_object();
+    }
+
+    BiasedOwner* _owner{ nullptr };
+
+    // Owner thread only, until it exits
+    int64_t _biased{ 1 };
+    bool _merged{ false };
+
+    std::atomic<int64_t> _shared{ 0 };
+    std::atomic<size_t> _weak_count{ 1 };
+};
+
+void BiasedOwner::enqueue(BiasedRefCount* block)
+{
+    {
+        std::scoped_lock lock{ _mutex };
+        if (!_exited)
+        {
+            _queued.push_back(block);
+            _has_queued.store(true, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // The owner is gone and no longer touches `_biased`; the lock ordered its last writes
+    block->_merge_queued();
+}
+
+void BiasedOwner::_drain()
+{
+    std::vector<BiasedRefCount*> queued;
+    {
+        std::scoped_lock lock{ _mutex };
+        queued.swap(_queued);
+        _has_queued.store(false, std::memory_order_relaxed);
+    }
+
+    for (auto* block : queued)
+        block->_merge_queued();
+}
+
+void BiasedOwner::_exit()
+{
+    std::vector<BiasedRefCount*> queued;
+    {
+        std::scoped_lock lock{ _mutex };
+        queued.swap(_queued);
+        _exited = true;
+    }
+
+    for (auto* block : queued)
+        block->_merge_queued();
+
+    release();
+}
+
+// A base class for the control block to allow for type erasure: the pointer-owning block and
+// make_shared's combined block are released the same way.
+template <typename RefCount>
+struct ControlBlockBase : public RefCount
+{
+    virtual ~ControlBlockBase() = default;
+
+    // Destroys the managed object, not the block
+    virtual void destroy_object() = 0;
+
+    virtual void* get_object() noexcept = 0;
+
+    void add_reference() noexcept
+    {
+        RefCount::add_strong();
+    }
+
+    bool try_add_reference() noexcept
+    {
+        return RefCount::try_add_strong();
+    }
+
+    void release_reference()
+    {
+        if (RefCount::release_strong())
+            release_object();
+    }
+
+    size_t use_count() const noexcept
+    {
+        return RefCount::strong_count();
+    }
+
+    void add_weak_reference() noexcept
+    {
+        RefCount::add_weak();
+    }
+
+    void release_weak_reference()
+    {
+        if (RefCount::release_weak())
+            delete this;
+    }
+
+    virtual void release_object()
+    {
+        destroy_object();
+        release_weak_reference();
+    }
+};
+
+// Control block for SharedPointer(T*): a second allocation next to the object
+template <typename T, typename RefCount>
+struct PointerControlBlock : public ControlBlockBase<RefCount>
+{
+    explicit PointerControlBlock(T* pointer) : _pointer{ pointer } { }
+
+    void destroy_object() override
+    {
+        delete _pointer;
+    }
+
+    void* get_object() noexcept override
+    {
+        return _pointer;
+    }
+
+    T* _pointer{ nullptr };
+};
+
+// Control block for make_shared: the object lives in storage inside the block, so both come
+// from a single allocation and the count sits next to the object in memory
+template <typename T, typename RefCount>
+struct InplaceControlBlock : public ControlBlockBase<RefCount>
 {
-    size_t _count{ };
-    mutable std::mutex _mutex; // better with std::atomic<size_t>
+    template <typename... Args>
+    explicit InplaceControlBlock(Args&&... args)
+    {
+        ::new (static_cast<void*>(_storage)) T(std::forward<Args>(args)...);
+    }
+
+    T* object() noexcept
+    {
+        return std::launder(reinterpret_cast<T*>(_storage));
+    }
+
+    void destroy_object() override
+    {
+        object()->~T();
+    }
+
+    void* get_object() noexcept override
+    {
+        return object();
+    }
+
+    alignas(T) unsigned char _storage[sizeof(T)];
 };
 
+template <typename T, typename RefCount = AtomicRefCount>
+class SharedPointer;
+
+template <typename T, typename RefCount = AtomicRefCount>
+class WeakPointer;
+
+// The policy comes second, before the constructor arguments: make_shared<T, BiasedRefCount>(args...)
+template <typename T, typename RefCount = AtomicRefCount, typename... Args>
+SharedPointer<T, RefCount> make_shared(Args&&... args);
+
 // SharedPointer hold internally the pointer and points to a `count` object shared by other
 // SharedPointer objects holding the same underlying pointer
-template <typename T>
+template <typename T, typename RefCount>
 class SharedPointer
 {
 public:
@@ -57,7 +545,7 @@ public:
     // Move constructor
     SharedPointer(SharedPointer&& other) noexcept
     {
-        _steal_from(other);
+        _steal_from(std::move(other));
     }
 
     // Move assignment
@@ -67,7 +555,7 @@ public:
             return *this;
 
         _try_release();
-        _steal_from(other);
+        _steal_from(std::move(other));
 
         return *this;
     }
@@ -93,10 +581,10 @@ public:
         _try_release();
     }
 
+    // Only a snapshot when other threads copy or destroy pointers to the same object
     size_t get_count() const
     {
-        std::scoped_lock lock{ _block->_mutex };
-        return _block->_count;
+        return _block ? _block->use_count() : 0;
     }
 
     T* get() const { return _pointer; }
@@ -106,6 +594,24 @@ public:
 
 private:
 
+    template <typename U, typename R, typename... Args>
+    friend SharedPointer<U, R> make_shared(Args&&... args);
+
+    friend class WeakPointer<T, RefCount>;
+
+    template <typename U>
+    friend class AtomicSharedPointer;
+
+    // Adopts a block whose count already includes this reference
+    SharedPointer(T* pointer, ControlBlockBase<RefCount>* block) noexcept
+    : _pointer{ pointer }
+    , _block{ block }
+    {
+    }
+
+    // `other` holds a reference for the duration of the copy, so the block cannot be
+    // destroyed underneath us; copying a SharedPointer that another thread is assigning to
+    // at the same time is a data race, as with std::shared_ptr.
     void _copy_from(const SharedPointer& other) noexcept
     {
         _pointer = other._pointer;
@@ -113,12 +619,8 @@ private:
 
         if (_block == nullptr)
             return;
-        
-        // Don't we have a dangling pointer if thread is descheduled and other thread's SharedPointer is destroyed?
-        // Or maybe we don't worry about mutex here?
 
-        std::scoped_lock lock{ _block->_mutex };
-        _block->_count++;
+        _block->add_reference();
     }
 
     void _steal_from(SharedPointer&& other) noexcept
@@ -132,86 +634,954 @@ private:
         _pointer = pointer;
         if (_pointer)
         {
-            _block = new ControlBlock{1};
+            try
+            {
+                _block = new PointerControlBlock<T, RefCount>{ _pointer };
+            }
+            catch (...)
+            {
+                delete _pointer;
+                throw;
+            }
         } // don't allocate CB for nullptr
     }
 
+    // Always leaves this pointer empty, whether or not it held the last reference
     void _try_release()
     {
-        if (!_block)
-            return;
-            
-        {                      
-            // TODO: what is std::scoped_lock?
-            std::scoped_lock lock{ _block->_mutex };
-
-            if (--_block->_count != 0)
-                return;
-        }
-
-        delete _pointer;
+        auto* block = std::exchange(_block, nullptr);
         _pointer = nullptr;
 
-        delete _block;
-        _block = nullptr;
+        if (block)
+            block->release_reference();
     }
 
     T* _pointer{ nullptr };
-    ControlBlock* _block{ nullptr };
+    ControlBlockBase<RefCount>* _block{ nullptr };
 };
 
-int main()
-{   
-    return 0;
-}
-
-/*
-To add make_shared (to have single allocation) we need to modify control block slightly
-
-// A base class for the control block to allow for type erasure
-struct ControlBlockBase
+// One allocation for the object and its count, instead of two for SharedPointer(new T(...))
+template <typename T, typename RefCount, typename... Args>
+SharedPointer<T, RefCount> make_shared(Args&&... args)
 {
-    std::atomic<size_t> _strong_count{0};
-
-    virtual ~ControlBlockBase() = default; // Essential for polymorphism!
-
-    // Pure virtual function to destroy the managed object
-    virtual void destroy_object() = 0;
-};
+    auto* block = new InplaceControlBlock<T, RefCount>(std::forward<Args>(args)...);
+    return SharedPointer<T, RefCount>(block->object(), block);
+}
 
-// A derived control block that knows the type T of the object it manages
-template <typename T>
-struct ControlBlockImpl : public ControlBlockBase
+// WeakPointer observes an object owned by SharedPointers without keeping it alive, e.g. for a
+// cache that must not extend the lifetime of what it caches. It keeps the control block alive,
+// so with make_shared the object's storage is only freed once the last WeakPointer is gone.
+template <typename T, typename RefCount>
+class WeakPointer
 {
-    // We construct the T object in place within a buffer inside this class
-    // std::aligned_storage_t ensures memory is correctly aligned for T
-    std::aligned_storage_t<sizeof(T), alignof(T)> _storage;
-
-    // This method will be called to destruct the T object
-    void destroy_object() override
+public:
+    // Constructors
+    WeakPointer() noexcept = default;
+    WeakPointer(const SharedPointer<T, RefCount>& shared) noexcept
+    : _pointer{ shared._pointer }
+    , _block{ shared._block }
     {
-        // Cast the storage back to a T* and call the destructor explicitly
-        reinterpret_cast<T*>(&_storage)->~T();
+        if (_block)
+            _block->add_weak_reference();
     }
-};
 
-template <typename T, typename... Args>
-SharedPointer<T> make_shared(Args&&... args)
-{
-    // 1. Perform the SINGLE heap allocation.
-    // We allocate our combined object that holds both the control block logic
-    // and the storage for T.
-    auto* block_impl = new ControlBlockImpl<T>();
-
-    // 2. Construct the T object in the aligned storage within the control block.
-    // This is "placement new". We pass the arguments perfectly forwarded.
-    T* pointer = new (&block_impl->_storage) T(std::forward<Args>(args)...);
-
-    // 3. Set the initial reference count.
-    block_impl->_strong_count = 1;
+    // Copy constructor
+    WeakPointer(const WeakPointer& other) noexcept
+    {
+        _copy_from(other);
+    }
 
-    // 4. Return a SharedPointer using the private constructor.
-    // It now shares ownership of the single allocated block.
-    return SharedPointer<T>(pointer, block_impl);
+    // Copy assignment
+    WeakPointer& operator=(const WeakPointer& other) noexcept
+    {
+        if (this == &other)
+            return *this;
+
+        _try_release();
+        _copy_from(other);
+
+        return *this;
+    }
+
+    // Move constructor
+    WeakPointer(WeakPointer&& other) noexcept
+    : _pointer{ std::exchange(other._pointer, nullptr) }
+    , _block{ std::exchange(other._block, nullptr) }
+    {
+    }
+
+    // Move assignment
+    WeakPointer& operator=(WeakPointer&& other) noexcept
+    {
+        if (this == &other)
+            return *this;
+
+        _try_release();
+        _pointer = std::exchange(other._pointer, nullptr);
+        _block = std::exchange(other._block, nullptr);
+
+        return *this;
+    }
+
+    // Destructor
+    ~WeakPointer()
+    {
+        _try_release();
+    }
+
+    void reset() noexcept
+    {
+        _try_release();
+    }
+
+    // Returns an empty SharedPointer if the object has already been destroyed
+    SharedPointer<T, RefCount> lock() const noexcept
+    {
+        if (_block && _block->try_add_reference())
+            return SharedPointer<T, RefCount>(_pointer, _block);
+
+        return SharedPointer<T, RefCount>();
+    }
+
+    size_t use_count() const noexcept
+    {
+        return _block ? _block->use_count() : 0;
+    }
+
+    // Only a snapshot: use lock() to get at the object
+    bool expired() const noexcept
+    {
+        return use_count() == 0;
+    }
+
+private:
+
+    void _copy_from(const WeakPointer& other) noexcept
+    {
+        _pointer = other._pointer;
+        _block = other._block;
+
+        if (_block)
+            _block->add_weak_reference();
+    }
+
+    void _try_release() noexcept
+    {
+        auto* block = std::exchange(_block, nullptr);
+        _pointer = nullptr;
+
+        if (block)
+            block->release_weak_reference();
+    }
+
+    T* _pointer{ nullptr };
+    ControlBlockBase<RefCount>* _block{ nullptr };
+};
+
+// AtomicSharedPointer publishes immutable snapshots (reference data, limits) that many
+// threads load on every request while a writer occasionally swaps in a new version. Loads
+// and stores are lock-free, and a writer never waits for readers.
+
+// The block pointer shares one 64-bit word with a local count of loads (split reference
+// counting). The stored block carries Precredit strong references on behalf of future
+// loads, so a load is a single fetch_add on the word: the local count it gets back is a
+// reference already counted in the block, and nothing needs to be handed back afterwards.
+// When the word is replaced, the references no load has claimed (Precredit minus the local
+// count) are released. Every load that finds the local count at Refill or above tops the
+// block up, so a loader preempted before its top-up only delays it: the loads after it top
+// up instead. The local count stays within the precredit as long as fewer than
+// Precredit - Refill loads are in flight between a fetch_add and the top-up.
+
+// get_count() on a pointer to a stored object includes the unclaimed precredit.
+
+// Assumes user-space pointers fit in 48 bits, as on x86-64 and AArch64 (the local count
+// takes the top 16). Only for the default AtomicRefCount.
+template <typename T>
+class AtomicSharedPointer
+{
+    static_assert(sizeof(void*) == sizeof(uint64_t), "the local count is packed into the pointer's top 16 bits");
+
+    using Pointer = SharedPointer<T, AtomicRefCount>;
+    using Block = ControlBlockBase<AtomicRefCount>;
+
+public:
+    // Constructors
+    AtomicSharedPointer() noexcept = default;
+    AtomicSharedPointer(Pointer desired)
+    : _word{ _adopt(std::move(desired)) }
+    {
+    }
+
+    AtomicSharedPointer(const AtomicSharedPointer&) = delete;
+    AtomicSharedPointer& operator=(const AtomicSharedPointer&) = delete;
+
+    // Destructor
+    ~AtomicSharedPointer()
+    {
+        _retire(_word.load(std::memory_order_acquire));
+    }
+
+    Pointer load() const
+    {
+        auto word = _word.fetch_add(OneLocal, std::memory_order_acquire);
+        auto* block = _block_of(word);
+        if (block == nullptr)
+            return Pointer();
+
+        if (_local_of(word) + 1 >= Refill)
+            _refill(block);
+
+        return Pointer(static_cast<T*>(block->get_object()), block);
+    }
+
+    void store(Pointer desired)
+    {
+        exchange(std::move(desired));
+    }
+
+    Pointer exchange(Pointer desired)
+    {
+        auto word = _word.exchange(_adopt(std::move(desired)), std::memory_order_acq_rel);
+        return _retire_keeping_one(word);
+    }
+
+    // Compares by the object owned, as std::atomic<std::shared_ptr> does. On failure
+    // `expected` is replaced by the current value.
+    bool compare_exchange_strong(Pointer& expected, Pointer desired)
+    {
+        auto word = _word.load(std::memory_order_relaxed);
+        auto desired_word = _adopt(std::move(desired));
+        while (_block_of(word) == expected._block)
+        {
+            if (_word.compare_exchange_weak(word, desired_word, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                _retire(word);
+                return true;
+            }
+        }
+
+        _retire(desired_word);
+        expected = load();
+        return false;
+    }
+
+    bool compare_exchange_weak(Pointer& expected, Pointer desired)
+    {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+
+    bool is_lock_free() const noexcept
+    {
+        return _word.is_lock_free();
+    }
+
+private:
+
+    static constexpr int LocalShift{ 48 };
+    static constexpr uint64_t OneLocal{ uint64_t{ 1 } << LocalShift };
+    static constexpr uint64_t BlockMask{ OneLocal - 1 };
+
+    static constexpr size_t Precredit{ size_t{ 1 } << 15 };
+    static constexpr size_t Refill{ size_t{ 1 } << 14 };
+
+    static Block* _block_of(uint64_t word) noexcept
+    {
+        return reinterpret_cast<Block*>(word & BlockMask);
+    }
+
+    static size_t _local_of(uint64_t word) noexcept
+    {
+        return static_cast<size_t>(word >> LocalShift);
+    }
+
+    static void _release(Block* block, size_t count)
+    {
+        if (block->_count.fetch_sub(count, std::memory_order_acq_rel) == count)
+            block->release_object();
+    }
+
+    // Turns desired's reference into the word's own, plus the precredit for loads
+    static uint64_t _adopt(Pointer desired) noexcept
+    {
+        auto* block = std::exchange(desired._block, nullptr);
+        desired._pointer = nullptr;
+        if (block == nullptr)
+            return 0;
+
+        block->_count.fetch_add(Precredit, std::memory_order_relaxed);
+        return reinterpret_cast<uint64_t>(block);
+    }
+
+    // Releases the word's own reference and the precredit no load has claimed
+    static void _retire(uint64_t word)
+    {
+        if (auto* block = _block_of(word))
+            _release(block, Precredit - _local_of(word) + 1);
+    }
+
+    // As _retire, but hands the word's own reference to the caller; that reference keeps the
+    // block alive, so the release cannot destroy it
+    static Pointer _retire_keeping_one(uint64_t word)
+    {
+        auto* block = _block_of(word);
+        if (block == nullptr)
+            return Pointer();
+
+        if (auto unclaimed = Precredit - _local_of(word))
+            block->_count.fetch_sub(unclaimed, std::memory_order_relaxed);
+
+        return Pointer(static_cast<T*>(block->get_object()), block);
+    }
+
+    // Adds Refill references and takes Refill off the local count, which keeps the word's
+    // precredit intact for whichever generation of the block is stored; if the block has
+    // been replaced, or another load has already topped it up, the references are given
+    // back. The caller's own reference keeps the block alive throughout.
+    void _refill(Block* block) const
+    {
+        block->_count.fetch_add(Refill, std::memory_order_relaxed);
+
+        auto word = _word.load(std::memory_order_relaxed);
+        while (_block_of(word) == block && _local_of(word) >= Refill)
+        {
+            if (_word.compare_exchange_weak(word, word - Refill * OneLocal, std::memory_order_relaxed))
+                return;
+        }
+
+        _release(block, Refill);
+    }
+
+    mutable std::atomic<uint64_t> _word{ 0 };
+};
+
+// Intrusive reference counting: the count lives in the object, through a CRTP base, so there
+// is no control block. An IntrusivePointer is a single pointer, copies touch only the object's
+// own cache line, and a raw T* can be turned back into an owning pointer at any time.
+
+// What happens to the object when the last reference goes is up to the Release policy:
+// DeleteRelease deletes it, PoolRelease hands it back to ObjectPool<T> for reuse.
+
+struct DeleteRelease
+{
+    template <typename T>
+    static void release(T* object)
+    {
+        delete object;
+    }
+};
+
+// Keeps the storage of destroyed objects in a per-thread free list, so creating and
+// destroying objects of one type at a high rate does not go through the allocator. An object
+// released on another thread than it was created on is cached by the releasing thread.
+template <typename T>
+class ObjectPool
+{
+public:
+
+    template <typename... Args>
+    static T* create(Args&&... args)
+    {
+        auto* storage = _allocate();
+        try
+        {
+            return ::new (storage) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            _deallocate(storage);
+            throw;
+        }
+    }
+
+    static void destroy(T* object)
+    {
+        object->~T();
+        _deallocate(object);
+    }
+
+private:
+
+    static constexpr size_t MaxCached{ 1024 };
+
+    struct FreeSlot
+    {
+        FreeSlot* _next{ nullptr };
+    };
+
+    static constexpr size_t SlotSize{ sizeof(T) > sizeof(FreeSlot) ? sizeof(T) : sizeof(FreeSlot) };
+    static constexpr std::align_val_t SlotAlignment{ alignof(T) > alignof(FreeSlot) ? alignof(T) : alignof(FreeSlot) };
+
+    struct Cache
+    {
+        ~Cache()
+        {
+            _destroyed = true;
+            while (_free != nullptr)
+                ::operator delete(std::exchange(_free, _free->_next), SlotAlignment);
+        }
+
+        FreeSlot* _free{ nullptr };
+        size_t _count{ 0 };
+    };
+
+    static Cache& _local_cache()
+    {
+        thread_local Cache cache{ };
+        return cache;
+    }
+
+    static void* _allocate()
+    {
+        // As for _deallocate, objects created during thread exit bypass the destroyed cache
+        if (_destroyed)
+            return ::operator new(SlotSize, SlotAlignment);
+
+        auto& cache = _local_cache();
+        if (cache._free == nullptr)
+            return ::operator new(SlotSize, SlotAlignment);
+
+        cache._count--;
+        return std::exchange(cache._free, cache._free->_next);
+    }
+
+    static void _deallocate(void* storage)
+    {
+        // The cache is gone when thread_locals destroyed after it release objects
+        if (_destroyed)
+        {
+            ::operator delete(storage, SlotAlignment);
+            return;
+        }
+
+        auto& cache = _local_cache();
+        if (cache._count == MaxCached)
+        {
+            ::operator delete(storage, SlotAlignment);
+            return;
+        }
+
+        cache._free = ::new (storage) FreeSlot{ cache._free };
+        cache._count++;
+    }
+
+    static inline thread_local bool _destroyed{ false };
+};
+
+struct PoolRelease
+{
+    template <typename T>
+    static void release(T* object)
+    {
+        ObjectPool<T>::destroy(object);
+    }
+};
+
+// class Order : public IntrusiveRefCount<Order, PoolRelease> { ... };
+// Derived must be the most derived type, or have a virtual destructor for DeleteRelease.
+template <typename Derived, typename Release = DeleteRelease>
+class IntrusiveRefCount
+{
+public:
+
+    void add_reference() const noexcept
+    {
+        _references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release_reference() const
+    {
+        if (_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            Release::release(const_cast<Derived*>(static_cast<const Derived*>(this)));
+    }
+
+    size_t use_count() const noexcept
+    {
+        return _references.load(std::memory_order_relaxed);
+    }
+
+protected:
+
+    IntrusiveRefCount() noexcept = default;
+
+    // A copy of the object is a new object, with no references to it yet
+    IntrusiveRefCount(const IntrusiveRefCount&) noexcept { }
+    IntrusiveRefCount& operator=(const IntrusiveRefCount&) noexcept { return *this; }
+
+    ~IntrusiveRefCount() = default;
+
+private:
+
+    mutable std::atomic<size_t> _references{ 0 };
+};
+
+// T must provide add_reference() and release_reference(), usually through IntrusiveRefCount
+template <typename T>
+class IntrusivePointer
+{
+public:
+    // Constructors
+    IntrusivePointer() noexcept = default;
+    IntrusivePointer(std::nullptr_t) noexcept { }
+
+    // Takes a new reference, so this also works for objects that already have owners
+    IntrusivePointer(T* pointer) noexcept
+    : _pointer{ pointer }
+    {
+        if (_pointer)
+            _pointer->add_reference();
+    }
+
+    // Copy constructor
+    IntrusivePointer(const IntrusivePointer& other) noexcept
+    : IntrusivePointer(other._pointer)
+    {
+    }
+
+    // Copy assignment
+    IntrusivePointer& operator=(const IntrusivePointer& other)
+    {
+        IntrusivePointer(other).swap(*this);
+        return *this;
+    }
+
+    // Move constructor
+    IntrusivePointer(IntrusivePointer&& other) noexcept
+    : _pointer{ std::exchange(other._pointer, nullptr) }
+    {
+    }
+
+    // Move assignment
+    IntrusivePointer& operator=(IntrusivePointer&& other)
+    {
+        IntrusivePointer(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    // Destructor
+    ~IntrusivePointer()
+    {
+        if (_pointer)
+            _pointer->release_reference();
+    }
+
+    void reset(T* pointer = nullptr)
+    {
+        IntrusivePointer(pointer).swap(*this);
+    }
+
+    void swap(IntrusivePointer& other) noexcept
+    {
+        std::swap(_pointer, other._pointer);
+    }
+
+    size_t get_count() const { return _pointer ? _pointer->use_count() : 0; }
+
+    T* get() const { return _pointer; }
+    T* operator->() const { return _pointer; }
+    T& operator*() const { return *_pointer; }
+    operator bool() const noexcept { return _pointer != nullptr; }
+
+private:
+
+    T* _pointer{ nullptr };
+};
+
+template <typename T, typename... Args>
+IntrusivePointer<T> make_intrusive(Args&&... args)
+{
+    return IntrusivePointer<T>(new T(std::forward<Args>(args)...));
+}
+
+// For types released with PoolRelease
+template <typename T, typename... Args>
+IntrusivePointer<T> make_pooled(Args&&... args)
+{
+    return IntrusivePointer<T>(ObjectPool<T>::create(std::forward<Args>(args)...));
+}
+
+TEST_CASE( "WeakPointer observes without owning.", "[shared_ptr]" )
+{
+    struct Tracked
+    {
+        explicit Tracked(std::atomic<int>& destroyed) : _destroyed{ destroyed } { }
+        ~Tracked() { _value = 0; _destroyed++; }
+
+        int _value{ 42 };
+        std::atomic<int>& _destroyed;
+    };
+
+    std::atomic<int> destroyed{ 0 };
+
+    SECTION( "lock, expired and use_count follow the owners." )
+    {
+        auto shared = ::make_shared<Tracked>(destroyed);
+        WeakPointer<Tracked> weak(shared);
+        REQUIRE( weak.use_count() == 1 );
+        REQUIRE( weak.expired() == false );
+
+        {
+            auto locked = weak.lock();
+            REQUIRE( locked.get() == shared.get() );
+            REQUIRE( weak.use_count() == 2 );
+
+            shared.reset();
+            REQUIRE( weak.expired() == false );
+            REQUIRE( locked->_value == 42 );
+        }
+
+        REQUIRE( destroyed == 1 );
+        REQUIRE( weak.expired() == true );
+        REQUIRE( weak.use_count() == 0 );
+        REQUIRE( weak.lock().get() == nullptr );
+
+        weak.reset();
+        REQUIRE( weak.use_count() == 0 );
+    }
+
+    SECTION( "lock races the last owner's reset." )
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            auto shared = ::make_shared<Tracked>(destroyed);
+            WeakPointer<Tracked> weak(shared);
+
+            std::atomic<bool> go{ false };
+            std::thread owner([&shared, &go]
+            {
+                while (!go.load())
+                    std::this_thread::yield();
+
+                shared.reset();
+            });
+
+            go.store(true);
+            if (auto locked = weak.lock())
+                REQUIRE( locked->_value == 42 );
+
+            owner.join();
+            REQUIRE( weak.expired() == true );
+            REQUIRE( weak.lock().get() == nullptr );
+            REQUIRE( destroyed == i + 1 );
+        }
+    }
+}
+
+TEST_CASE( "BiasedRefCount hands the count over between owner and other threads.", "[shared_ptr]" )
+{
+    struct Tracked
+    {
+        Tracked(std::atomic<int>& destroyed, std::thread::id& destroyed_on) : _destroyed{ destroyed }, _destroyed_on{ destroyed_on } { }
+        ~Tracked() { _destroyed_on = std::this_thread::get_id(); _destroyed++; }
+
+        std::atomic<int>& _destroyed;
+        std::thread::id& _destroyed_on;
+    };
+
+    std::atomic<int> destroyed{ 0 };
+    std::thread::id destroyed_on{ };
+
+    SECTION( "Copies on the owner thread stay biased." )
+    {
+        auto pointer = ::make_shared<Tracked, BiasedRefCount>(destroyed, destroyed_on);
+        {
+            auto copy = pointer;
+            auto another = copy;
+            REQUIRE( pointer.get_count() == 3 );
+        }
+
+        REQUIRE( pointer.get_count() == 1 );
+        REQUIRE( destroyed == 0 );
+
+        pointer.reset();
+        REQUIRE( destroyed == 1 );
+    }
+
+    SECTION( "A release on another thread is merged by the owner." )
+    {
+        auto pointer = ::make_shared<Tracked, BiasedRefCount>(destroyed, destroyed_on);
+        auto copy = pointer;
+
+        // The owner's two references are biased; releasing one elsewhere queues the block
+        std::thread([moved = std::move(copy)]() mutable { moved.reset(); }).join();
+        REQUIRE( destroyed == 0 );
+
+        // The owner's next release merges the queued block, leaving its last reference
+        auto another = pointer;
+        another.reset();
+        REQUIRE( destroyed == 0 );
+        REQUIRE( pointer.get_count() == 1 );
+
+        pointer.reset();
+        REQUIRE( destroyed == 1 );
+        REQUIRE( destroyed_on == std::this_thread::get_id() );
+    }
+
+    SECTION( "The last release can happen on another thread." )
+    {
+        auto pointer = ::make_shared<Tracked, BiasedRefCount>(destroyed, destroyed_on);
+
+        std::thread::id releaser{ };
+        std::atomic<bool> copied{ false };
+        std::atomic<bool> owner_done{ false };
+
+        // The copy is taken on the other thread, so it is counted in the shared count
+        std::thread other([&]
+        {
+            auto copy = pointer;
+            copied.store(true);
+            while (!owner_done.load())
+                std::this_thread::yield();
+
+            releaser = std::this_thread::get_id();
+            copy.reset();
+        });
+
+        while (!copied.load())
+            std::this_thread::yield();
+
+        // Dropping the owner's last biased reference merges the block
+        pointer.reset();
+        REQUIRE( destroyed == 0 );
+
+        owner_done.store(true);
+        other.join();
+
+        REQUIRE( destroyed == 1 );
+        REQUIRE( destroyed_on == releaser );
+    }
+
+    SECTION( "References outlive the owner thread." )
+    {
+        SharedPointer<Tracked, BiasedRefCount> survivor;
+        std::thread([&survivor, &destroyed, &destroyed_on]
+        {
+            auto pointer = ::make_shared<Tracked, BiasedRefCount>(destroyed, destroyed_on);
+            survivor = pointer;
+        }).join();
+
+        REQUIRE( destroyed == 0 );
+
+        auto copy = survivor;
+        copy.reset();
+        REQUIRE( destroyed == 0 );
+
+        survivor.reset();
+        REQUIRE( destroyed == 1 );
+    }
+}
+
+// Readers check each snapshot is intact while a writer replaces it. There are more readers
+// than cores and many loads per snapshot, so the local count passes Refill over and over with
+// loaders preempted around their top-up.
+TEST_CASE( "AtomicSharedPointer under concurrent loads and stores.", "[shared_ptr]" )
+{
+    struct Snapshot
+    {
+        explicit Snapshot(int value, std::atomic<int>& alive) : _value{ value }, _check{ ~value }, _alive{ alive } { _alive++; }
+        ~Snapshot() { _check = _value; _alive--; }
+
+        bool intact() const { return _check == ~_value; }
+
+        int _value;
+        int _check;
+        std::atomic<int>& _alive;
+    };
+
+    std::atomic<int> alive{ 0 };
+
+    SECTION( "One thread holds more loads than the precredit covers." )
+    {
+        AtomicSharedPointer<Snapshot> published(::make_shared<Snapshot>(0, alive));
+
+        std::vector<SharedPointer<Snapshot>> held(100000);
+        for (auto& snapshot : held)
+            snapshot = published.load();
+
+        published.store(::make_shared<Snapshot>(1, alive));
+        REQUIRE( held.front().get_count() == held.size() );
+        REQUIRE( held.back()->intact() );
+
+        held.clear();
+        REQUIRE( alive == 1 );
+        REQUIRE( published.load()->_value == 1 );
+    }
+
+    SECTION( "Readers race a writer." )
+    {
+        {
+            AtomicSharedPointer<Snapshot> published(::make_shared<Snapshot>(0, alive));
+            std::atomic<bool> done{ false };
+            std::atomic<int> torn{ 0 };
+
+            std::vector<std::thread> readers;
+            for (int t = 0; t < 16; t++)
+            {
+                readers.emplace_back([&]
+                {
+                    std::vector<SharedPointer<Snapshot>> recent(64);
+                    for (size_t i = 0; !done.load(std::memory_order_relaxed) || i < 100000; i++)
+                    {
+                        auto& snapshot = recent[i % recent.size()];
+                        snapshot = published.load();
+                        if (!snapshot->intact())
+                            torn++;
+                    }
+                });
+            }
+
+            for (int i = 1; i <= 2000; i++)
+            {
+                if (i % 2 == 0)
+                {
+                    published.store(::make_shared<Snapshot>(i, alive));
+                    continue;
+                }
+
+                auto expected = published.load();
+                published.compare_exchange_strong(expected, ::make_shared<Snapshot>(i, alive));
+            }
+
+            done = true;
+            for (auto& reader : readers)
+                reader.join();
+
+            REQUIRE( torn == 0 );
+            REQUIRE( published.load()->_value == 2000 );
+        }
+
+        REQUIRE( alive == 0 );
+    }
+}
+
+// Copy and destroy on this thread, alone and while other threads copy the same pointer.
+// MutexRefCount guards plain counts with a mutex, as the original ControlBlock did. libstdc++
+// skips std::shared_ptr's atomics until a program starts its first thread, so the uncontended
+// std::shared_ptr figure depends on whether any test has started one yet.
+TEST_CASE( "Copy and destroy under each reference counting policy.", "[shared_ptr][!benchmark]" )
+{
+    struct MutexRefCount
+    {
+        mutable std::mutex _mutex;
+        size_t _count{ 1 };
+        size_t _weak_count{ 1 };
+
+        void add_strong() { std::lock_guard<std::mutex> lock(_mutex); _count++; }
+        bool try_add_strong() { std::lock_guard<std::mutex> lock(_mutex); return _count != 0 && ++_count; }
+        bool release_strong() { std::lock_guard<std::mutex> lock(_mutex); return --_count == 0; }
+        size_t strong_count() const { std::lock_guard<std::mutex> lock(_mutex); return _count; }
+
+        void add_weak() { std::lock_guard<std::mutex> lock(_mutex); _weak_count++; }
+        bool release_weak() { std::lock_guard<std::mutex> lock(_mutex); return --_weak_count == 0; }
+    };
+
+    auto copiers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    auto contend = [copiers](const auto& shared)
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned int t = 0; t < copiers; t++)
+        {
+            threads.emplace_back([&shared](std::stop_token stop)
+            {
+                while (!stop.stop_requested())
+                {
+                    auto copy = shared;
+                }
+            });
+        }
+
+        return threads;
+    };
+
+    auto std_shared = std::make_shared<int>(0);
+    auto mutex_shared = make_shared<int, MutexRefCount>(0);
+    auto atomic_shared = make_shared<int, AtomicRefCount>(0);
+    auto biased_shared = make_shared<int, BiasedRefCount>(0);
+    auto non_atomic_shared = make_shared<int, NonAtomicRefCount>(0);
+
+    BENCHMARK( "std::shared_ptr" ) { return std_shared; };
+    BENCHMARK( "MutexRefCount" ) { return mutex_shared; };
+    BENCHMARK( "AtomicRefCount" ) { return atomic_shared; };
+    BENCHMARK( "BiasedRefCount, owner thread" ) { return biased_shared; };
+    BENCHMARK( "NonAtomicRefCount" ) { return non_atomic_shared; };
+
+    // NonAtomicRefCount may only be copied on one thread, so it has no contended figure
+    {
+        auto threads = contend(std_shared);
+        BENCHMARK( "std::shared_ptr, contended" ) { return std_shared; };
+    }
+
+    {
+        auto threads = contend(mutex_shared);
+        BENCHMARK( "MutexRefCount, contended" ) { return mutex_shared; };
+    }
+
+    {
+        auto threads = contend(atomic_shared);
+        BENCHMARK( "AtomicRefCount, contended" ) { return atomic_shared; };
+    }
+
+    {
+        auto threads = contend(biased_shared);
+        BENCHMARK( "BiasedRefCount, owner thread, contended" ) { return biased_shared; };
+    }
+}
+
+// Several readers load snapshots while one writer keeps publishing new ones; each benchmark
+// times the load on this thread against that background.
+TEST_CASE( "AtomicSharedPointer load against a mutex-protected pointer.", "[shared_ptr][!benchmark]" )
+{
+    struct LockedSharedPointer
+    {
+        SharedPointer<int> load() const { std::lock_guard<std::mutex> lock(_mutex); return _pointer; }
+        void store(SharedPointer<int> desired) { std::lock_guard<std::mutex> lock(_mutex); std::swap(_pointer, desired); }
+
+        mutable std::mutex _mutex;
+        SharedPointer<int> _pointer;
+    };
+
+    auto readers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    auto publish = [readers](auto& published)
+    {
+        published.store(make_shared<int>(0));
+
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&published](std::stop_token stop)
+        {
+            for (int i = 1; !stop.stop_requested(); i++)
+            {
+                published.store(make_shared<int>(i));
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+
+        for (unsigned int t = 0; t < readers; t++)
+        {
+            threads.emplace_back([&published](std::stop_token stop)
+            {
+                while (!stop.stop_requested())
+                    published.load();
+            });
+        }
+
+        return threads;
+    };
+
+    {
+        AtomicSharedPointer<int> published;
+        auto threads = publish(published);
+
+        BENCHMARK( "AtomicSharedPointer" ) { return published.load(); };
+    }
+
+    {
+        LockedSharedPointer published;
+        auto threads = publish(published);
+
+        BENCHMARK( "std::mutex and SharedPointer" ) { return published.load(); };
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    return Catch::Session().run(argc, argv);
 }
-*/
@@ -1,21 +1,37 @@
 #include <utility>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include <catch2/catch_session.hpp> // For testing.
+#include <catch2/catch_test_macros.hpp> // For testing.
 
 /*
 Constructors
 - UniquePointer(std::nullptr_t)
 - UniquePointer(T*)
+- UniquePointer(T*, Deleter)
 
 release()
 reset(T* = nullptr)
 swap(UniquePointer&)
 get()
+get_deleter()
 operator*()
 operator->()
-*/
-
+operator bool()
 
+UniquePointer<T[]>: operator[] instead of operator* and operator->
+*/
 
-// $$ What does this deleter do?
+// The default deleter, what the UniquePointer calls to free the object it owns. A deleter
+// can be any callable taking a T*, e.g. one holding the memory pool to return the object to:
+//
+// struct PoolDeleter
+// {
+//     void operator()(Order* order) const { pool_->deallocate(order); }
+//     Pool* pool_;
+// };
 template <typename T>
 struct CustomDeleter
 {
@@ -25,30 +41,47 @@ struct CustomDeleter
     }
 };
 
+template <typename T>
+struct CustomDeleter<T[]>
+{
+    void operator()(T* pointer) const
+    {
+        delete[] pointer;
+    }
+};
+
 // UniquePointer enforces unique ownership by disabling copy
-// Memory freeing is done similar to SharedPointer
-template <typename T, typename Deleter = CustomDeleter<T>> // $$ what is the deleter?
+// Memory freeing is done similar to SharedPointer, except that every path (destructor,
+// reset, move assignment) goes through the stored deleter
+
+// The deleter is a member marked [[no_unique_address]], so a stateless deleter such as
+// CustomDeleter takes no space and UniquePointer stays the size of a pointer
+template <typename T, typename Deleter = CustomDeleter<T>>
 class UniquePointer
 {
 public:
     UniquePointer() noexcept = default; 
     UniquePointer(std::nullptr_t) noexcept : UniquePointer() {}
-    UniquePointer(T* pointer) : pointer_{ pointer } {}
+    UniquePointer(T* pointer) noexcept : pointer_{ pointer } {}
+    UniquePointer(T* pointer, const Deleter& deleter) : pointer_{ pointer }, deleter_{ deleter } {}
+    UniquePointer(T* pointer, Deleter&& deleter) : pointer_{ pointer }, deleter_{ std::move(deleter) } {}
 
     UniquePointer(const UniquePointer&) = delete;
     UniquePointer& operator=(const UniquePointer&) = delete;
 
     UniquePointer(UniquePointer&& other) noexcept
+    : deleter_{ std::move(other.deleter_) }
     {
-        _steal_from(other);
+        _steal_from(std::move(other));
     }
 
     UniquePointer& operator=(UniquePointer&& other) noexcept
     {
         if (this != &other)
         {
-            // deletes current `pointer_`
+            // deletes current `pointer_` with the current deleter, then takes other's
             reset(other.release());
+            deleter_ = std::move(other.deleter_);
         }
 
         return *this;
@@ -56,8 +89,8 @@ public:
 
     ~UniquePointer()
     {
-        Deleter deleter;
-        deleter(pointer_);
+        if (pointer_)
+            deleter_(pointer_);
     }
 
     T* release()
@@ -68,24 +101,27 @@ public:
     void reset(T* pointer = nullptr)
     {
         // prevent passing self and double delete
-        if (pointer_ != pointer) delete pointer_;
+        if (pointer_ == pointer)
+            return;
 
-        pointer_ = pointer;
+        // set first, so a deleter that reaches back into this pointer sees the new value
+        if (auto* old = std::exchange(pointer_, pointer))
+            deleter_(old);
     }
 
     void swap(UniquePointer& uniquePointer)
     {
         std::swap(pointer_, uniquePointer.pointer_);
+        std::swap(deleter_, uniquePointer.deleter_);
     }
 
-    Deleter get_deleter() const
-    {
-        return { };
-    }
+    Deleter& get_deleter() { return deleter_; }
+    const Deleter& get_deleter() const { return deleter_; }
 
     T* get() const { return pointer_; }
     T& operator*() const { return *pointer_; }
     T* operator->() const { return pointer_; }
+    explicit operator bool() const noexcept { return pointer_ != nullptr; }
 
 private:
 
@@ -95,9 +131,164 @@ private:
     }
 
     T* pointer_{ nullptr };
+    [[no_unique_address]] Deleter deleter_{ };
+};
+
+// Array version: owns a T[] allocated with new[] (or by an arena or pool, with a matching
+// deleter). Indexing replaces operator* and operator->
+template <typename T, typename Deleter>
+class UniquePointer<T[], Deleter>
+{
+public:
+    UniquePointer() noexcept = default;
+    UniquePointer(std::nullptr_t) noexcept : UniquePointer() {}
+    explicit UniquePointer(T* pointer) noexcept : pointer_{ pointer } {}
+    UniquePointer(T* pointer, const Deleter& deleter) : pointer_{ pointer }, deleter_{ deleter } {}
+    UniquePointer(T* pointer, Deleter&& deleter) : pointer_{ pointer }, deleter_{ std::move(deleter) } {}
+
+    UniquePointer(const UniquePointer&) = delete;
+    UniquePointer& operator=(const UniquePointer&) = delete;
+
+    UniquePointer(UniquePointer&& other) noexcept
+    : pointer_{ std::exchange(other.pointer_, nullptr) }
+    , deleter_{ std::move(other.deleter_) }
+    {
+    }
+
+    UniquePointer& operator=(UniquePointer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset(other.release());
+            deleter_ = std::move(other.deleter_);
+        }
+
+        return *this;
+    }
+
+    ~UniquePointer()
+    {
+        if (pointer_)
+            deleter_(pointer_);
+    }
+
+    T* release()
+    {
+        return std::exchange(pointer_, nullptr);
+    }
+
+    void reset(T* pointer = nullptr)
+    {
+        // prevent passing self and double delete
+        if (pointer_ == pointer)
+            return;
+
+        if (auto* old = std::exchange(pointer_, pointer))
+            deleter_(old);
+    }
+
+    void swap(UniquePointer& uniquePointer)
+    {
+        std::swap(pointer_, uniquePointer.pointer_);
+        std::swap(deleter_, uniquePointer.deleter_);
+    }
+
+    Deleter& get_deleter() { return deleter_; }
+    const Deleter& get_deleter() const { return deleter_; }
+
+    T* get() const { return pointer_; }
+    T& operator[](std::size_t index) const { return pointer_[index]; }
+    explicit operator bool() const noexcept { return pointer_ != nullptr; }
+
+private:
+
+    T* pointer_{ nullptr };
+    [[no_unique_address]] Deleter deleter_{ };
 };
 
-int main()
+static_assert(sizeof(UniquePointer<int>) == sizeof(int*));
+static_assert(sizeof(UniquePointer<int[]>) == sizeof(int*));
+
+TEST_CASE( "UniquePointer frees through its deleter.", "[unique_ptr]" )
+{
+    static int destroyed;
+    destroyed = 0;
+
+    struct Tracked
+    {
+        ~Tracked() { destroyed++; }
+    };
+
+    SECTION( "The default deleter keeps the pointer's size." )
+    {
+        REQUIRE( sizeof(UniquePointer<Tracked>) == sizeof(Tracked*) );
+
+        UniquePointer<Tracked> pointer(new Tracked);
+        pointer.reset(new Tracked);
+        REQUIRE( destroyed == 1 );
+
+        // Resetting to the pointer already owned must not free it
+        pointer.reset(pointer.get());
+        REQUIRE( destroyed == 1 );
+        REQUIRE( pointer );
+
+        pointer.reset();
+        REQUIRE( destroyed == 2 );
+    }
+
+    SECTION( "A stateful deleter returns objects to its pool." )
+    {
+        struct Pool
+        {
+            std::vector<Tracked*> returned;
+        };
+
+        struct PoolDeleter
+        {
+            void operator()(Tracked* tracked) const { pool_->returned.push_back(tracked); }
+            Pool* pool_;
+        };
+
+        Pool first;
+        Pool second;
+        Tracked a;
+        Tracked b;
+        Tracked c;
+
+        {
+            UniquePointer<Tracked, PoolDeleter> pointer(&a, PoolDeleter{ &first });
+            REQUIRE( pointer.get_deleter().pool_ == &first );
+
+            pointer.reset(&b);
+            REQUIRE( first.returned == std::vector<Tracked*>{ &a } );
+
+            // Move assignment frees b with the current deleter, then takes the other's
+            UniquePointer<Tracked, PoolDeleter> other(&c, PoolDeleter{ &second });
+            pointer = std::move(other);
+            REQUIRE( first.returned == std::vector<Tracked*>{ &a, &b } );
+            REQUIRE( pointer.get_deleter().pool_ == &second );
+            REQUIRE( other.get() == nullptr );
+
+            auto moved = std::move(pointer);
+            REQUIRE( moved.get() == &c );
+        }
+
+        REQUIRE( second.returned == std::vector<Tracked*>{ &c } );
+        REQUIRE( destroyed == 0 );
+    }
+
+    SECTION( "Arrays are freed with delete[]." )
+    {
+        {
+            UniquePointer<Tracked[]> array(new Tracked[4]);
+            REQUIRE( &array[3] == array.get() + 3 );
+        }
+
+        REQUIRE( destroyed == 4 );
+    }
+}
+
+int main(int argc, char* argv[])
 {
-    return 0;
-}
\ No newline at end of file
+    return Catch::Session().run(argc, argv);
+}